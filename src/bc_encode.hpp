@@ -0,0 +1,426 @@
+#ifndef BC_ENCODE_HPP
+#define BC_ENCODE_HPP
+
+#include "glad/glad.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "gl_ext.hpp"
+#include "thread_pool.hpp"
+
+// Block compression (S3TC/RGTC) on the CPU, every 4x4 pixel block is encoded on its own:
+//   BC1  8 bytes: two RGB565 endpoints and a 2 bit index per pixel, for opaque images
+//   BC3 16 bytes: a BC4 block for alpha followed by a BC1 block for the colour
+//   BC4  8 bytes: one BC4 block for red, for grey images
+//   BC5 16 bytes: BC4 blocks for red and green, for grey alpha images and tangent space normal maps
+// where a BC4 block holds two 8 bit endpoints and a 3 bit index per pixel. Colour endpoints
+// come from the principal axis of the block's colours and are refined once by least squares,
+// indices are picked by projecting the pixels onto the line between the endpoints.
+
+enum class BlockFormat : uint32_t { BC1 = 1, BC3 = 3, BC4 = 4, BC5 = 5 };
+
+inline size_t blockBytes(BlockFormat format)
+{
+  return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+inline size_t compressedSize(BlockFormat format, int width, int height)
+{
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+inline GLenum glFormatOf(BlockFormat format)
+{
+  switch (format) {
+    case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BlockFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+    default: return GL_COMPRESSED_RG_RGTC2;
+  }
+}
+
+namespace bc {
+
+inline uint16_t pack565(const float color[3])
+{
+  const int r = (int)std::lround(std::clamp(color[0], 0.0f, 255.0f) * (31.0f / 255.0f));
+  const int g = (int)std::lround(std::clamp(color[1], 0.0f, 255.0f) * (63.0f / 255.0f));
+  const int b = (int)std::lround(std::clamp(color[2], 0.0f, 255.0f) * (31.0f / 255.0f));
+  return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+inline void unpack565(uint16_t packed, float color[3])
+{
+  const int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+  color[0] = (float)(r << 3 | r >> 2);
+  color[1] = (float)(g << 2 | g >> 4);
+  color[2] = (float)(b << 3 | b >> 2);
+}
+
+// BC1 indices for the 16 pixels (planar r, g, b) with the palette spanned by the decoded
+// endpoints c0 and c1, returns the squared error
+inline float selectIndices(const float *r, const float *g, const float *b, const float c0[3], const float c1[3],
+    uint32_t &indices)
+{
+  // position along c1 -> c0 in thirds to palette index
+  static const uint32_t CODES[4] = { 1, 3, 2, 0 };
+  const float d[3] = { c0[0] - c1[0], c0[1] - c1[1], c0[2] - c1[2] };
+  const float length2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+  const float scale = length2 > 0.0f ? 3.0f / length2 : 0.0f;
+  alignas(16) int32_t levels[16];
+  float error = 0.0f;
+#if defined(__SSE2__)
+  const __m128 dr = _mm_set1_ps(d[0]), dg = _mm_set1_ps(d[1]), db = _mm_set1_ps(d[2]);
+  const __m128 br = _mm_set1_ps(c1[0]), bg = _mm_set1_ps(c1[1]), bb = _mm_set1_ps(c1[2]);
+  const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+  __m128 sum = _mm_setzero_ps();
+  for (int i = 0; i < 16; i += 4) {
+    const __m128 pr = _mm_sub_ps(_mm_loadu_ps(r + i), br);
+    const __m128 pg = _mm_sub_ps(_mm_loadu_ps(g + i), bg);
+    const __m128 pb = _mm_sub_ps(_mm_loadu_ps(b + i), bb);
+    __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pr, dr), _mm_mul_ps(pg, dg)), _mm_mul_ps(pb, db));
+    t = _mm_min_ps(_mm_max_ps(_mm_mul_ps(t, _mm_set1_ps(scale)), _mm_setzero_ps()), _mm_set1_ps(3.0f));
+    const __m128i level = _mm_cvtps_epi32(t); // rounds to nearest
+    _mm_store_si128((__m128i *)(levels + i), level);
+    const __m128 w = _mm_mul_ps(_mm_cvtepi32_ps(level), third);
+    const __m128 er = _mm_sub_ps(pr, _mm_mul_ps(dr, w));
+    const __m128 eg = _mm_sub_ps(pg, _mm_mul_ps(dg, w));
+    const __m128 eb = _mm_sub_ps(pb, _mm_mul_ps(db, w));
+    sum = _mm_add_ps(sum, _mm_add_ps(_mm_add_ps(_mm_mul_ps(er, er), _mm_mul_ps(eg, eg)), _mm_mul_ps(eb, eb)));
+  }
+  alignas(16) float sums[4];
+  _mm_store_ps(sums, sum);
+  error = sums[0] + sums[1] + sums[2] + sums[3];
+#else
+  for (int i = 0; i < 16; i++) {
+    const float p[3] = { r[i] - c1[0], g[i] - c1[1], b[i] - c1[2] };
+    const float t = std::clamp((p[0] * d[0] + p[1] * d[1] + p[2] * d[2]) * scale, 0.0f, 3.0f);
+    levels[i] = (int32_t)std::nearbyint(t);
+    const float w = levels[i] / 3.0f;
+    for (int k = 0; k < 3; k++) error += (p[k] - d[k] * w) * (p[k] - d[k] * w);
+  }
+#endif
+  indices = 0;
+  for (int i = 0; i < 16; i++) indices |= CODES[levels[i]] << (2 * i);
+  return error;
+}
+
+// encodes endpoints e0, e1 (not yet quantized), returns the squared error
+inline float encodeEndpoints(const float *r, const float *g, const float *b, const float e0[3], const float e1[3],
+    uint16_t &q0, uint16_t &q1, uint32_t &indices)
+{
+  q0 = pack565(e0);
+  q1 = pack565(e1);
+  float c0[3], c1[3];
+  unpack565(q0, c0);
+  unpack565(q1, c1);
+  return selectIndices(r, g, b, c0, c1, indices);
+}
+
+} // namespace bc
+
+// rgba holds the 16 pixels row by row, alpha is ignored
+inline void encodeBC1Block(const uint8_t rgba[64], uint8_t out[8])
+{
+  alignas(16) float r[16], g[16], b[16];
+  float mean[3] = { 0.0f, 0.0f, 0.0f };
+  for (int i = 0; i < 16; i++) {
+    r[i] = rgba[4 * i];
+    g[i] = rgba[4 * i + 1];
+    b[i] = rgba[4 * i + 2];
+    mean[0] += r[i];
+    mean[1] += g[i];
+    mean[2] += b[i];
+  }
+  for (float &m : mean) m *= 1.0f / 16.0f;
+
+  // covariance, then its dominant eigenvector by power iteration
+  float cov[6] = { 0, 0, 0, 0, 0, 0 }; // rr rg rb gg gb bb
+  for (int i = 0; i < 16; i++) {
+    const float x = r[i] - mean[0], y = g[i] - mean[1], z = b[i] - mean[2];
+    cov[0] += x * x; cov[1] += x * y; cov[2] += x * z;
+    cov[3] += y * y; cov[4] += y * z; cov[5] += z * z;
+  }
+  float axis[3] = { 1.0f, 1.0f, 1.0f };
+  for (int iteration = 0; iteration < 4; iteration++) {
+    const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    const float length = std::max({ std::fabs(x), std::fabs(y), std::fabs(z) });
+    if (length == 0.0f) break;
+    axis[0] = x / length;
+    axis[1] = y / length;
+    axis[2] = z / length;
+  }
+
+  float tMin = 0.0f, tMax = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    const float t = (r[i] - mean[0]) * axis[0] + (g[i] - mean[1]) * axis[1] + (b[i] - mean[2]) * axis[2];
+    tMin = std::min(tMin, t);
+    tMax = std::max(tMax, t);
+  }
+  float e0[3], e1[3];
+  if (tMax - tMin < 0.5f) {
+    // a flat block, straddle the colour with the neighbouring 565 values so that the
+    // interpolated palette entries get closer to it than one endpoint alone
+    static const float LEVELS[3] = { 31.0f, 63.0f, 31.0f };
+    for (int k = 0; k < 3; k++) {
+      const float level = std::floor(mean[k] * LEVELS[k] / 255.0f);
+      e1[k] = level * 255.0f / LEVELS[k];
+      e0[k] = std::min(level + 1.0f, LEVELS[k]) * 255.0f / LEVELS[k];
+    }
+  } else {
+    // pull the extremes in a little, the palette then covers the bulk of the pixels better
+    const float inset = (tMax - tMin) / 16.0f;
+    tMin += inset;
+    tMax -= inset;
+    for (int k = 0; k < 3; k++) {
+      e0[k] = mean[k] + axis[k] * tMax;
+      e1[k] = mean[k] + axis[k] * tMin;
+    }
+  }
+
+  uint16_t q0, q1;
+  uint32_t indices;
+  float error = bc::encodeEndpoints(r, g, b, e0, e1, q0, q1, indices);
+
+  // least squares endpoints for the chosen indices, each pixel is w * e0 + (1 - w) * e1
+  if (error > 0.0f) {
+    static const float WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f, ap[3] = { 0, 0, 0 }, bp[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+      const float w = WEIGHTS[indices >> (2 * i) & 3], v = 1.0f - w;
+      aa += w * w; ab += w * v; bb += v * v;
+      ap[0] += w * r[i]; ap[1] += w * g[i]; ap[2] += w * b[i];
+      bp[0] += v * r[i]; bp[1] += v * g[i]; bp[2] += v * b[i];
+    }
+    const float det = aa * bb - ab * ab;
+    if (std::fabs(det) > 1e-6f) {
+      float f0[3], f1[3];
+      for (int k = 0; k < 3; k++) {
+        f0[k] = (bb * ap[k] - ab * bp[k]) / det;
+        f1[k] = (aa * bp[k] - ab * ap[k]) / det;
+      }
+      uint16_t p0, p1;
+      uint32_t refined;
+      const float refinedError = bc::encodeEndpoints(r, g, b, f0, f1, p0, p1, refined);
+      if (refinedError < error) {
+        q0 = p0;
+        q1 = p1;
+        indices = refined;
+      }
+    }
+  }
+
+  // four colour mode needs q0 > q1, swapping the endpoints swaps indices 0/1 and 2/3
+  if (q0 < q1) {
+    std::swap(q0, q1);
+    indices ^= 0x55555555u;
+  } else if (q0 == q1) {
+    indices = 0;
+  }
+  out[0] = q0 & 0xFF; out[1] = q0 >> 8;
+  out[2] = q1 & 0xFF; out[3] = q1 >> 8;
+  out[4] = indices & 0xFF; out[5] = indices >> 8 & 0xFF; out[6] = indices >> 16 & 0xFF; out[7] = indices >> 24;
+}
+
+// one channel (0 red ... 3 alpha) of the 16 RGBA pixels
+inline void encodeBC4Block(const uint8_t rgba[64], int channel, uint8_t out[8])
+{
+  // position between min (0) and max (7) to index, max and min are the endpoints 0 and 1
+  static const uint64_t CODES[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+  int lo = 255, hi = 0;
+  for (int i = 0; i < 16; i++) {
+    lo = std::min(lo, (int)rgba[4 * i + channel]);
+    hi = std::max(hi, (int)rgba[4 * i + channel]);
+  }
+  out[0] = hi;
+  out[1] = lo;
+  uint64_t indices = 0;
+  if (hi > lo) {
+    const int range = hi - lo;
+    for (int i = 0; i < 16; i++) {
+      const int position = ((rgba[4 * i + channel] - lo) * 14 + range) / (2 * range); // rounded
+      indices |= CODES[position] << (3 * i);
+    }
+  }
+  for (int k = 0; k < 6; k++) out[2 + k] = indices >> (8 * k) & 0xFF;
+}
+
+inline void encodeBlock(BlockFormat format, const uint8_t rgba[64], uint8_t *out)
+{
+  switch (format) {
+    case BlockFormat::BC1:
+      encodeBC1Block(rgba, out);
+      break;
+    case BlockFormat::BC3:
+      encodeBC4Block(rgba, 3, out);
+      encodeBC1Block(rgba, out + 8);
+      break;
+    case BlockFormat::BC4:
+      encodeBC4Block(rgba, 0, out);
+      break;
+    case BlockFormat::BC5:
+      encodeBC4Block(rgba, 0, out);
+      encodeBC4Block(rgba, 1, out + 8);
+      break;
+  }
+}
+
+inline void decodeBC1Block(const uint8_t in[8], uint8_t rgba[64])
+{
+  const uint16_t q0 = in[0] | in[1] << 8, q1 = in[2] | in[3] << 8;
+  float c[4][3];
+  bc::unpack565(q0, c[0]);
+  bc::unpack565(q1, c[1]);
+  uint8_t palette[4][4];
+  for (int k = 0; k < 3; k++) {
+    if (q0 > q1) {
+      c[2][k] = (2.0f * c[0][k] + c[1][k]) / 3.0f;
+      c[3][k] = (c[0][k] + 2.0f * c[1][k]) / 3.0f;
+    } else {
+      c[2][k] = (c[0][k] + c[1][k]) / 2.0f;
+      c[3][k] = 0.0f;
+    }
+  }
+  for (int j = 0; j < 4; j++) {
+    for (int k = 0; k < 3; k++) palette[j][k] = (uint8_t)std::lround(c[j][k]);
+    palette[j][3] = (j == 3 && q0 <= q1) ? 0 : 255;
+  }
+  const uint32_t indices = in[4] | in[5] << 8 | in[6] << 16 | (uint32_t)in[7] << 24;
+  for (int i = 0; i < 16; i++) std::memcpy(rgba + 4 * i, palette[indices >> (2 * i) & 3], 4);
+}
+
+inline void decodeBC4Block(const uint8_t in[8], int channel, uint8_t rgba[64])
+{
+  const int e0 = in[0], e1 = in[1];
+  int palette[8] = { e0, e1 };
+  if (e0 > e1) {
+    for (int j = 2; j < 8; j++) palette[j] = ((8 - j) * e0 + (j - 1) * e1 + 3) / 7;
+  } else {
+    for (int j = 2; j < 6; j++) palette[j] = ((6 - j) * e0 + (j - 1) * e1 + 2) / 5;
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+  uint64_t indices = 0;
+  for (int k = 0; k < 6; k++) indices |= (uint64_t)in[2 + k] << (8 * k);
+  for (int i = 0; i < 16; i++) rgba[4 * i + channel] = palette[indices >> (3 * i) & 7];
+}
+
+inline void decodeBlock(BlockFormat format, const uint8_t *in, uint8_t rgba[64])
+{
+  switch (format) {
+    case BlockFormat::BC1:
+      decodeBC1Block(in, rgba);
+      break;
+    case BlockFormat::BC3:
+      decodeBC1Block(in + 8, rgba);
+      decodeBC4Block(in, 3, rgba);
+      break;
+    case BlockFormat::BC4:
+      std::memset(rgba, 0, 64);
+      decodeBC4Block(in, 0, rgba);
+      for (int i = 0; i < 16; i++) rgba[4 * i + 3] = 255;
+      break;
+    case BlockFormat::BC5:
+      std::memset(rgba, 0, 64);
+      decodeBC4Block(in, 0, rgba);
+      decodeBC4Block(in + 8, 1, rgba);
+      for (int i = 0; i < 16; i++) rgba[4 * i + 3] = 255;
+      break;
+  }
+}
+
+// the 4x4 block at block coordinates (bx, by) of an image with 1-4 channels (stbi order:
+// grey, grey alpha, rgb, rgba) as RGBA, pixels past the edges repeat the last row/column;
+// grey and grey alpha land in red and green like the GL_R8 and GL_RG8 uploads read them
+inline void fetchBlock(const uint8_t *pixels, int width, int height, int channels, int bx, int by, uint8_t rgba[64])
+{
+  for (int y = 0; y < 4; y++) {
+    const int sy = std::min(by * 4 + y, height - 1);
+    for (int x = 0; x < 4; x++) {
+      const int sx = std::min(bx * 4 + x, width - 1);
+      const uint8_t *p = pixels + ((size_t)sy * width + sx) * channels;
+      uint8_t *q = rgba + 4 * (4 * y + x);
+      switch (channels) {
+        case 1: q[0] = p[0]; q[1] = q[2] = 0; q[3] = 255; break;
+        case 2: q[0] = p[0]; q[1] = p[1]; q[2] = 0; q[3] = 255; break;
+        case 3: q[0] = p[0]; q[1] = p[1]; q[2] = p[2]; q[3] = 255; break;
+        default: std::memcpy(q, p, 4); break;
+      }
+    }
+  }
+}
+
+// BC4 and BC5 for grey and grey alpha images, BC3 for rgba images with any alpha below
+// 255, BC1 otherwise
+inline BlockFormat blockFormatFor(const uint8_t *pixels, int width, int height, int channels)
+{
+  if (channels == 1) return BlockFormat::BC4;
+  if (channels == 2) return BlockFormat::BC5;
+  if (channels != 4) return BlockFormat::BC1;
+  const size_t count = (size_t)width * height;
+  for (size_t i = 0; i < count; i++)
+    if (pixels[i * channels + channels - 1] != 255) return BlockFormat::BC3;
+  return BlockFormat::BC1;
+}
+
+// compresses a whole image, with a pool the block rows are spread over its workers (do not
+// pass the pool whose task is calling, tasks must not wait on their own pool)
+inline std::vector<uint8_t> compressImage(const uint8_t *pixels, int width, int height, int channels,
+    BlockFormat format, ThreadPool *pool = nullptr)
+{
+  const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+  const size_t rowBytes = blocksX * blockBytes(format);
+  std::vector<uint8_t> out(rowBytes * blocksY);
+  auto encodeRows = [&](int first, int last) {
+    alignas(16) uint8_t rgba[64];
+    for (int by = first; by < last; by++) {
+      uint8_t *dst = out.data() + by * rowBytes;
+      for (int bx = 0; bx < blocksX; bx++) {
+        fetchBlock(pixels, width, height, channels, bx, by, rgba);
+        encodeBlock(format, rgba, dst + bx * blockBytes(format));
+      }
+    }
+  };
+  const int ROWS_PER_TASK = 8;
+  if (!pool || blocksY <= ROWS_PER_TASK) {
+    encodeRows(0, blocksY);
+    return out;
+  }
+  std::vector<std::future<void>> pending;
+  for (int first = 0; first < blocksY; first += ROWS_PER_TASK)
+    pending.push_back(pool->submit([&encodeRows, first, blocksY, ROWS_PER_TASK]() {
+      encodeRows(first, std::min(first + ROWS_PER_TASK, blocksY));
+    }));
+  for (std::future<void> &task : pending) task.get();
+  return out;
+}
+
+// RGBA pixels of a compressed image, for measuring the quality of the encoder
+inline std::vector<uint8_t> decompressImage(const uint8_t *data, int width, int height, BlockFormat format)
+{
+  const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+  std::vector<uint8_t> out((size_t)width * height * 4);
+  uint8_t rgba[64];
+  for (int by = 0; by < blocksY; by++) {
+    for (int bx = 0; bx < blocksX; bx++) {
+      decodeBlock(format, data + ((size_t)by * blocksX + bx) * blockBytes(format), rgba);
+      for (int y = 0; y < 4 && by * 4 + y < height; y++)
+        for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+          std::memcpy(&out[((size_t)(by * 4 + y) * width + bx * 4 + x) * 4], rgba + 4 * (4 * y + x), 4);
+    }
+  }
+  return out;
+}
+
+#endif
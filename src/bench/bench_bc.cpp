@@ -0,0 +1,140 @@
+// Block compression benchmark, prints one JSON object to stdout.
+//   make bench_bc && ./bin/bench_bc [options] [image...]
+// For every image: the decode time of the raw path, BC encode throughput on one thread and
+// on defaultThreadPool(), the size against the uncompressed upload and the PSNR of the
+// decoded blocks against the source. The images default to the backpack's textures.
+//
+// --format bc1|bc3|bc4|bc5 overrides the format TextureLoader would pick, --iterations sets
+// how often every encode is timed (the best run counts), --write bakes the texture caches
+// that compressed loads use, mip chain included.
+
+#include "glad/glad.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "bc_encode.hpp"
+#include "texture_loader.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+static void usage()
+{
+  std::cerr << "usage: bench_bc [--format bc1|bc3|bc4|bc5] [--iterations <n>] [--write] [image...]" << std::endl;
+  std::exit(EXIT_FAILURE);
+}
+
+static double msSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// over the channels the format keeps: rgb for BC1, rgba for BC3, r for BC4, rg for BC5
+static double psnr(const unsigned char *source, int channels, const std::vector<uint8_t> &decoded, int width, int height,
+    BlockFormat format)
+{
+  const int numChannels = format == BlockFormat::BC4 ? 1
+                        : format == BlockFormat::BC5 ? 2
+                        : format == BlockFormat::BC3 ? 4 : 3;
+  double error = 0.0;
+  size_t count = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      // the same channel expansion as the encoder, one pixel at a time
+      uint8_t expected[64];
+      fetchBlock(source + ((size_t)y * width + x) * channels, 1, 1, channels, 0, 0, expected);
+      const uint8_t *actual = &decoded[((size_t)y * width + x) * 4];
+      for (int c = 0; c < numChannels; c++) {
+        const double d = (double)expected[c] - actual[c];
+        error += d * d;
+        count++;
+      }
+    }
+  }
+  error /= count;
+  return error == 0.0 ? 99.0 : 10.0 * std::log10(255.0 * 255.0 / error);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<std::string> files;
+  std::string formatName;
+  int iterations = 3;
+  bool write = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--format" && i + 1 < argc) formatName = argv[++i];
+    else if (arg == "--iterations" && i + 1 < argc) iterations = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--write") write = true;
+    else if (arg.rfind("--", 0) == 0) usage();
+    else files.push_back(arg);
+  }
+  if (files.empty()) {
+    files.push_back(STRING(ASSETS_DIR)"backpack/diffuse.jpg");
+    files.push_back(STRING(ASSETS_DIR)"backpack/specular.jpg");
+  }
+  if (!formatName.empty() && formatName != "bc1" && formatName != "bc3" && formatName != "bc4" && formatName != "bc5") usage();
+
+  std::cout << "{\n  \"threads\": " << defaultThreadPool().size() << ",\n  \"images\": [";
+  for (size_t f = 0; f < files.size(); f++) {
+    const std::string &file = files[f];
+    int width, height, channels;
+    auto start = std::chrono::steady_clock::now();
+    unsigned char *pixels = stbi_load(file.c_str(), &width, &height, &channels, 0);
+    const double decodeMs = msSince(start);
+    if (!pixels) {
+      std::cerr << "failed to load " << file << std::endl;
+      return EXIT_FAILURE;
+    }
+    BlockFormat format = blockFormatFor(pixels, width, height, channels);
+    if (formatName == "bc1") format = BlockFormat::BC1;
+    else if (formatName == "bc3") format = BlockFormat::BC3;
+    else if (formatName == "bc4") format = BlockFormat::BC4;
+    else if (formatName == "bc5") format = BlockFormat::BC5;
+
+    double serialMs = INFINITY, parallelMs = INFINITY;
+    std::vector<uint8_t> blocks;
+    for (int i = 0; i < iterations; i++) {
+      start = std::chrono::steady_clock::now();
+      blocks = compressImage(pixels, width, height, channels, format);
+      serialMs = std::min(serialMs, msSince(start));
+      start = std::chrono::steady_clock::now();
+      blocks = compressImage(pixels, width, height, channels, format, &defaultThreadPool());
+      parallelMs = std::min(parallelMs, msSince(start));
+    }
+    const double quality = psnr(pixels, channels, decompressImage(blocks.data(), width, height, format), width, height, format);
+    const double megapixels = (double)width * height * 1e-6;
+    stbi_image_free(pixels);
+
+    bool written = false;
+    if (write) written = TextureLoader::bake(file, TextureLoader::COMPRESS | TextureLoader::SRGB, &defaultThreadPool());
+
+    // the raw path uploads the decoded bytes as they are
+    const size_t rawBytes = (size_t)width * height * channels;
+    std::cout << (f == 0 ? "\n" : ",\n")
+              << "    {\n"
+              << "      \"file\": \"" << file << "\",\n"
+              << "      \"width\": " << width << ",\n"
+              << "      \"height\": " << height << ",\n"
+              << "      \"channels\": " << channels << ",\n"
+              << "      \"format\": \"bc" << (int)format << "\",\n"
+              << "      \"raw_bytes\": " << rawBytes << ",\n"
+              << "      \"compressed_bytes\": " << blocks.size() << ",\n"
+              << "      \"ratio\": " << (double)rawBytes / blocks.size() << ",\n"
+              << "      \"decode_ms\": " << decodeMs << ",\n"
+              << "      \"encode_serial_ms\": " << serialMs << ",\n"
+              << "      \"encode_parallel_ms\": " << parallelMs << ",\n"
+              << "      \"encode_serial_mpix_s\": " << megapixels / (serialMs * 1e-3) << ",\n"
+              << "      \"encode_parallel_mpix_s\": " << megapixels / (parallelMs * 1e-3) << ",\n"
+              << "      \"psnr_db\": " << quality;
+    if (write) std::cout << ",\n      \"cache_written\": " << (written ? "true" : "false");
+    std::cout << "\n    }";
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+  return 0;
+}
@@ -0,0 +1,309 @@
+// Headless Model load benchmark, prints one JSON object to stdout.
+//   make bench_load && ./bin/bench_load [options] [model]
+// The model defaults to the backpack. A first run with the mesh and texture caches enabled
+// writes the caches, so run twice to compare a cold against a warm load.
+//
+// There is no GL context: the glad function pointers that loading touches are replaced by
+// stubs. Buffer uploads are copied into scratch memory the way a driver would, everything
+// else is a no-op, so upload times are the CPU side only.
+//
+// --trace <file> writes the load as Chrome trace JSON, --verbose logs every traced span
+// to stderr. --frames <n> draws the loaded model n times afterwards and reports the CPU time
+// per frame and how many binds glState() issued and skipped, with --queue the frames go
+// through Model::enqueue and a RenderQueue, seen from (0, 0, 5) like in main.cpp, --ring
+// additionally passes the matrices through a ConstantRing (its orphaning fallback, as the
+// stubs provide no buffer storage). --indirect sets ModelLoadOptions::indirectDraw (and the
+// textureArrays it needs) against a stubbed glMultiDrawElementsIndirect, the frames then draw
+// through it unless queued.
+
+#include "glad/glad.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+#include "model.hpp"
+#include "render_queue.hpp"
+#include "constant_ring.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// the window size of main.cpp, for the projection and the LOD error
+static const int VIEWPORT_WIDTH = 800;
+static const int VIEWPORT_HEIGHT = 600;
+
+static std::vector<char> uploadScratch;
+static std::vector<char> mappedScratch;
+static GLuint nextName = 1;
+
+static void APIENTRY stubGen(GLsizei n, GLuint *names) { for (GLsizei i = 0; i < n; i++) names[i] = nextName++; }
+static void APIENTRY stubDelete(GLsizei, const GLuint *) {}
+static void APIENTRY stubBind(GLenum, GLuint) {}
+static void APIENTRY stubBindVertexArray(GLuint) {}
+static void APIENTRY stubBufferData(GLenum, GLsizeiptr size, const void *data, GLenum)
+{
+  if (uploadScratch.size() < (size_t)size) uploadScratch.resize(size);
+  if (data) std::memcpy(uploadScratch.data(), data, size);
+}
+static void APIENTRY stubBufferSubData(GLenum, GLintptr offset, GLsizeiptr size, const void *data)
+{
+  if (uploadScratch.size() < (size_t)(offset + size)) uploadScratch.resize(offset + size);
+  std::memcpy(uploadScratch.data() + offset, data, size);
+}
+static void *APIENTRY stubMapBufferRange(GLenum, GLintptr, GLsizeiptr length, GLbitfield)
+{
+  if (mappedScratch.size() < (size_t)length) mappedScratch.resize(length);
+  return mappedScratch.data();
+}
+static GLboolean APIENTRY stubUnmapBuffer(GLenum) { return GL_TRUE; }
+static void APIENTRY stubEnableVertexAttribArray(GLuint) {}
+static void APIENTRY stubVertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void *) {}
+static void APIENTRY stubTexImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void *) {}
+static void APIENTRY stubTexParameteri(GLenum, GLenum, GLint) {}
+static void APIENTRY stubPixelStorei(GLenum, GLint) {}
+static void APIENTRY stubGenerateMipmap(GLenum) {}
+static void APIENTRY stubCompressedTexImage2D(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei size, const void *data)
+{
+  if (uploadScratch.size() < (size_t)size) uploadScratch.resize(size);
+  if (data) std::memcpy(uploadScratch.data(), data, size);
+}
+static void APIENTRY stubTexImage3D(GLenum, GLint, GLint, GLsizei, GLsizei, GLsizei, GLint, GLenum, GLenum, const void *) {}
+static void APIENTRY stubTexSubImage3D(GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum, GLenum,
+    const void *) {}
+static void APIENTRY stubCompressedTexImage3D(GLenum, GLint, GLenum, GLsizei, GLsizei, GLsizei, GLint, GLsizei, const void *) {}
+static void APIENTRY stubCompressedTexSubImage3D(GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum,
+    GLsizei size, const void *data)
+{
+  stubCompressedTexImage2D(0, 0, 0, 0, 0, 0, size, data);
+}
+static GLuint APIENTRY stubCreate() { return nextName++; }
+static GLuint APIENTRY stubCreateShader(GLenum) { return nextName++; }
+static void APIENTRY stubShaderSource(GLuint, GLsizei, const GLchar *const *, const GLint *) {}
+static void APIENTRY stubName(GLuint) {}
+static void APIENTRY stubAttachShader(GLuint, GLuint) {}
+static void APIENTRY stubGetiv(GLuint, GLenum, GLint *value) { *value = GL_TRUE; }
+static GLint APIENTRY stubGetUniformLocation(GLuint, const GLchar *) { return 0; }
+static void APIENTRY stubUniform1i(GLint, GLint) {}
+static void APIENTRY stubUniformv(GLint, GLsizei, const GLfloat *) {}
+static void APIENTRY stubUniformMatrix4fv(GLint, GLsizei, GLboolean, const GLfloat *) {}
+static void APIENTRY stubActiveTexture(GLenum) {}
+static void APIENTRY stubDrawElements(GLenum, GLsizei, GLenum, const void *) {}
+static void APIENTRY stubCopyBufferSubData(GLenum, GLenum, GLintptr, GLintptr, GLsizeiptr) {}
+static void APIENTRY stubVertexAttribDivisor(GLuint, GLuint) {}
+static void APIENTRY stubMultiDrawElementsIndirect(GLenum, GLenum, const void *, GLsizei, GLsizei) {}
+static void APIENTRY stubBindBufferRange(GLenum, GLuint, GLuint, GLintptr, GLsizeiptr) {}
+static GLuint APIENTRY stubGetUniformBlockIndex(GLuint, const GLchar *) { return 0; }
+static void APIENTRY stubUniformBlockBinding(GLuint, GLuint, GLuint) {}
+static void APIENTRY stubMultiDrawElements(GLenum, const GLsizei *, GLenum, const void *const *, GLsizei) {}
+static void APIENTRY stubDrawElementsBaseVertex(GLenum, GLsizei, GLenum, const void *, GLint) {}
+static void APIENTRY stubMultiDrawElementsBaseVertex(GLenum, const GLsizei *, GLenum, const void *const *, GLsizei,
+    const GLint *) {}
+// the only extension there is
+static void APIENTRY stubGetIntegerv(GLenum name, GLint *value) { *value = name == GL_NUM_EXTENSIONS ? 1 : 0; }
+static const GLubyte *APIENTRY stubGetStringi(GLenum, GLuint) { return (const GLubyte *)"GL_EXT_texture_compression_s3tc"; }
+
+static void stubGl()
+{
+  glad_glGenVertexArrays = stubGen;
+  glad_glGenBuffers = stubGen;
+  glad_glGenTextures = stubGen;
+  glad_glDeleteTextures = stubDelete;
+  glad_glBindBuffer = stubBind;
+  glad_glBindTexture = stubBind;
+  glad_glBindVertexArray = stubBindVertexArray;
+  glad_glBufferData = stubBufferData;
+  glad_glMapBufferRange = stubMapBufferRange;
+  glad_glUnmapBuffer = stubUnmapBuffer;
+  glad_glEnableVertexAttribArray = stubEnableVertexAttribArray;
+  glad_glVertexAttribPointer = stubVertexAttribPointer;
+  glad_glTexImage2D = stubTexImage2D;
+  glad_glTexParameteri = stubTexParameteri;
+  glad_glPixelStorei = stubPixelStorei;
+  glad_glGenerateMipmap = stubGenerateMipmap;
+  glad_glCompressedTexImage2D = stubCompressedTexImage2D;
+  glad_glTexImage3D = stubTexImage3D;
+  glad_glTexSubImage3D = stubTexSubImage3D;
+  glad_glCompressedTexImage3D = stubCompressedTexImage3D;
+  glad_glCompressedTexSubImage3D = stubCompressedTexSubImage3D;
+  glad_glGetIntegerv = stubGetIntegerv;
+  glad_glGetStringi = stubGetStringi;
+  // --frames
+  glad_glCreateShader = stubCreateShader;
+  glad_glShaderSource = stubShaderSource;
+  glad_glCompileShader = stubName;
+  glad_glGetShaderiv = stubGetiv;
+  glad_glCreateProgram = stubCreate;
+  glad_glAttachShader = stubAttachShader;
+  glad_glLinkProgram = stubName;
+  glad_glGetProgramiv = stubGetiv;
+  glad_glDeleteShader = stubName;
+  glad_glUseProgram = stubName;
+  glad_glGetUniformLocation = stubGetUniformLocation;
+  glad_glUniform1i = stubUniform1i;
+  glad_glUniform3fv = stubUniformv;
+  glad_glUniformMatrix4fv = stubUniformMatrix4fv;
+  glad_glActiveTexture = stubActiveTexture;
+  glad_glDrawElements = stubDrawElements;
+  glad_glMultiDrawElements = stubMultiDrawElements;
+  glad_glBufferSubData = stubBufferSubData;
+  glad_glDeleteBuffers = stubDelete;
+  glad_glBindBufferRange = stubBindBufferRange;
+  glad_glCopyBufferSubData = stubCopyBufferSubData;
+  glad_glVertexAttribDivisor = stubVertexAttribDivisor;
+  glad_glDeleteVertexArrays = stubDelete;
+  glExt().multiDrawElementsIndirect = stubMultiDrawElementsIndirect;
+  glad_glGetUniformBlockIndex = stubGetUniformBlockIndex;
+  glad_glUniformBlockBinding = stubUniformBlockBinding;
+  glad_glDrawElementsBaseVertex = stubDrawElementsBaseVertex;
+  glad_glMultiDrawElementsBaseVertex = stubMultiDrawElementsBaseVertex;
+}
+
+static void usage()
+{
+  std::cerr << "usage: bench_load [--no-cache] [--serial] [--sync-textures] [--merge] [--optimize] [--quantize]\n"
+               "                  [--lods] [--meshlets] [--streaming] [--release-cpu] [--compress-textures]\n"
+               "                  [--no-texture-cache] [--texture-arrays] [--indirect]\n"
+               "                  [--frames <n>] [--queue] [--ring] [--trace <file>] [--verbose] [model]" << std::endl;
+  std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  ModelLoadOptions options;
+  std::string path = STRING(ASSETS_DIR)"backpack/backpack.obj";
+  std::string traceFile;
+  int frames = 0;
+  bool queued = false;
+  bool ring = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--no-cache") options.useMeshCache = false;
+    else if (arg == "--serial") options.parallel = false;
+    else if (arg == "--sync-textures") options.asyncTextures = false;
+    else if (arg == "--merge") options.mergeMeshes = true;
+    else if (arg == "--optimize") options.optimizeMeshes = true;
+    else if (arg == "--quantize") options.quantizeVertices = true;
+    else if (arg == "--lods") options.generateLods = true;
+    else if (arg == "--meshlets") options.cullMeshlets = true;
+    else if (arg == "--streaming") options.streaming = true;
+    else if (arg == "--release-cpu") options.releaseCpuData = true;
+    else if (arg == "--compress-textures") options.compressTextures = true;
+    else if (arg == "--no-texture-cache") options.cacheTextures = false;
+    else if (arg == "--texture-arrays") options.textureArrays = true;
+    else if (arg == "--indirect") options.indirectDraw = options.textureArrays = true;
+    else if (arg == "--frames" && i + 1 < argc) frames = std::max(0, std::atoi(argv[++i]));
+    else if (arg == "--queue") queued = true;
+    else if (arg == "--ring") queued = ring = true;
+    else if (arg == "--trace" && i + 1 < argc) traceFile = argv[++i];
+    else if (arg == "--verbose") loadTrace().verbose = true;
+    else if (arg.rfind("--", 0) == 0) usage();
+    else path = arg;
+  }
+  stubGl();
+  if (!traceFile.empty()) loadTrace().start();
+
+  // the loader logs to std::cout, keep it out of the JSON
+  std::ostringstream log;
+  std::streambuf *stdoutBuffer = std::cout.rdbuf(log.rdbuf());
+
+  auto ms = [](std::chrono::steady_clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+  const auto start = std::chrono::steady_clock::now();
+  Model model(path, options);
+  while (model.update(1e9f) > 0) std::this_thread::yield();
+  const auto meshesDone = std::chrono::steady_clock::now();
+  textureLoader().finish();
+  const auto end = std::chrono::steady_clock::now();
+
+  double drawMs = 0;
+  if (frames > 0) {
+    const char *vertexShader = STRING(SOURCE_DIR)"/../shader.vs";
+    const char *fragmentShader = options.textureArrays ? STRING(SOURCE_DIR)"/../shader_array.fs" : STRING(SOURCE_DIR)"/../shader.fs";
+    if (ring) {
+      vertexShader = STRING(SOURCE_DIR)"/../shader_ring.vs";
+    } else if (model.drawsIndirect() && !queued) {
+      vertexShader = STRING(SOURCE_DIR)"/../shader_indirect.vs";
+      fragmentShader = STRING(SOURCE_DIR)"/../shader_indirect.fs";
+    }
+    Shader shader(vertexShader, fragmentShader);
+    if (ring) {
+      shader.setBlockBinding("Frame", ConstantRing::FRAME_BINDING);
+      shader.setBlockBinding("Draw", ConstantRing::DRAW_BINDING);
+    }
+    const glm::vec3 eye(0.0f, 0.0f, 5.0f);
+    const glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)VIEWPORT_WIDTH / VIEWPORT_HEIGHT, 0.1f, 100.0f);
+    const DrawView drawView{ glm::mat4(1.0f), view, projection, eye, (float)VIEWPORT_HEIGHT };
+    RenderQueue queue;
+    std::unique_ptr<ConstantRing> constants;
+    if (ring) constants = std::make_unique<ConstantRing>();
+    glState().resetCounters();
+    const auto drawStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+      shader.use();
+      if (constants) {
+        constants->beginFrame();
+        const GLintptr frame = constants->write(FrameConstants{ view, projection });
+        model.enqueue(queue, shader, drawView, 1.0f, constants.get());
+        constants->bind(ConstantRing::FRAME_BINDING, frame, sizeof(FrameConstants));
+        queue.flush();
+        constants->endFrame();
+      } else if (queued) {
+        model.enqueue(queue, shader, drawView);
+        queue.flush();
+      } else {
+        model.draw(shader);
+      }
+    }
+    drawMs = ms(std::chrono::steady_clock::now() - drawStart);
+  }
+
+  std::cout.rdbuf(stdoutBuffer);
+  if (loadTrace().verbose) std::cerr << log.str();
+  if (!traceFile.empty()) {
+    loadTrace().stop();
+    if (!loadTrace().writeChromeTrace(traceFile)) {
+      std::cerr << "failed to write " << traceFile << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  const ModelLoadStats &stats = model.loadStats();
+  std::cout << "{\n"
+            << "  \"model\": \"" << path << "\",\n"
+            << "  \"cache\": " << (options.useMeshCache ? "true" : "false") << ",\n"
+            << "  \"texture_cache\": " << (options.cacheTextures ? "true" : "false") << ",\n"
+            << "  \"parallel\": " << (options.parallel ? "true" : "false") << ",\n"
+            << "  \"threads\": " << defaultThreadPool().size() << ",\n"
+            << "  \"cache_ms\": " << stats.cacheMs << ",\n"
+            << "  \"import_ms\": " << stats.importMs << ",\n"
+            << "  \"convert_ms\": " << stats.convertMs << ",\n"
+            << "  \"mesh_upload_ms\": " << stats.uploadMs << ",\n"
+            << "  \"texture_decode_ms\": " << textureLoader().decodeMs() << ",\n"
+            << "  \"texture_upload_ms\": " << textureLoader().uploadMs() << ",\n"
+            << "  \"meshes_wall_ms\": " << ms(meshesDone - start) << ",\n"
+            << "  \"total_wall_ms\": " << ms(end - start) << ",\n"
+            << "  \"cpu_bytes\": " << model.cpuBytes() << ",\n"
+            << "  \"gpu_bytes\": " << model.gpuBytes() << ",\n"
+            << "  \"trace_events\": " << loadTrace().size() << ",\n"
+            << "  \"trace_dropped\": " << loadTrace().dropped() << ",\n"
+            << "  \"peak_rss_kb\": " << usage.ru_maxrss;
+  if (frames > 0) {
+    std::cout << ",\n  \"frames\": " << frames << ",\n"
+              << "  \"draw_ms_per_frame\": " << drawMs / frames << ",\n"
+              << "  \"gl_binds_issued_per_frame\": " << (double)glState().issued() / frames << ",\n"
+              << "  \"gl_binds_skipped_per_frame\": " << (double)glState().skipped() / frames;
+  }
+  std::cout << "\n}" << std::endl;
+  return 0;
+}
@@ -4,16 +4,17 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
 #include <iostream>
 #include <cmath>
 
 #include "common.hpp"
 #include "shader.hpp"
+#include "texture_loader.hpp"
 #include "camera.hpp"
 
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 static void processInput(GLFWwindow *window);
 static void mouse_callback(GLFWwindow *window, double xpos, double ypos);
@@ -67,8 +68,6 @@ int main(void)
     Shader lightCubeShader (STRING(SOURCE_DIR)"/lightCubeShader.vs", STRING(SOURCE_DIR)"/lightCubeShader.fs");
 
     std::string fname;
-    unsigned char *data;
-    int width, height, nrChannels;
 
 
     // set up diffuseMap texture
@@ -81,15 +80,10 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // generate texture and mimap
     fname = STRING(ASSETS_DIR)"container2.png";
-    data = stbi_load(fname.c_str(), &width, &height, &nrChannels, 0);
-    if (!data) {
+    if (!textureLoader().loadBound(fname, TextureLoader::CACHE | TextureLoader::FLIP_VERTICALLY | TextureLoader::SRGB)) {
         std::cout << "failed to load texture " << fname << std::endl;
         return -1;
     }
-    // note: .png is stored as RGBA
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data); data = nullptr;
 
     // set up diffuseMap texture
     unsigned int specularMap;
@@ -101,15 +95,10 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // generate texture and mimap
     fname = STRING(ASSETS_DIR)"container2_specular_colored.png";
-    data = stbi_load(fname.c_str(), &width, &height, &nrChannels, 0);
-    if (!data) {
+    if (!textureLoader().loadBound(fname, TextureLoader::CACHE | TextureLoader::FLIP_VERTICALLY)) {
         std::cout << "failed to load texture " << fname << std::endl;
         return -1;
     }
-    // note: .png is stored as RGBA
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data); data = nullptr;
 
 
     // set up vertices for a cube
@@ -4,15 +4,17 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
 #include <iostream>
 #include <cmath>
 
 #include "common.hpp"
 #include "shader.hpp"
+#include "texture_loader.hpp"
 #include "camera.hpp"
+#include "render_queue.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
 
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 static void processInput(GLFWwindow *window);
@@ -67,8 +69,6 @@ int main(void)
     Shader lightCubeShader (STRING(SOURCE_DIR)"/lightCubeShader.vs", STRING(SOURCE_DIR)"/lightCubeShader.fs");
 
     std::string fname;
-    unsigned char *data;
-    int width, height, nrChannels;
 
 
     // set up diffuseMap texture
@@ -81,15 +81,10 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // generate texture and mimap
     fname = STRING(ASSETS_DIR)"container2.png";
-    data = stbi_load(fname.c_str(), &width, &height, &nrChannels, 0);
-    if (!data) {
+    if (!textureLoader().loadBound(fname, TextureLoader::CACHE | TextureLoader::FLIP_VERTICALLY | TextureLoader::SRGB)) {
         std::cout << "failed to load texture " << fname << std::endl;
         return -1;
     }
-    // note: .png is stored as RGBA
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data); data = nullptr;
 
     // set up diffuseMap texture
     unsigned int specularMap;
@@ -101,15 +96,10 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // generate texture and mimap
     fname = STRING(ASSETS_DIR)"container2_specular.png";
-    data = stbi_load(fname.c_str(), &width, &height, &nrChannels, 0);
-    if (!data) {
+    if (!textureLoader().loadBound(fname, TextureLoader::CACHE | TextureLoader::FLIP_VERTICALLY)) {
         std::cout << "failed to load texture " << fname << std::endl;
         return -1;
     }
-    // note: .png is stored as RGBA
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data); data = nullptr;
 
 
     // set up vertices for a cube
@@ -200,6 +190,10 @@ int main(void)
 
     glm::vec3 lightPos(1.0f, 1.0f, 2.0f);
 
+    RenderQueue queue;
+    ArrayDrawSource cubes;
+    const GLsizei numVertices = sizeof(vertices)/sizeof(vertices[0])/8;
+
     /* Loop until the user closes the window */
     while (!glfwWindowShouldClose(window))
     {
@@ -239,19 +233,19 @@ int main(void)
         lightingShader.setMat4("view", view);
         lightingShader.setMat4("projection", projection);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, diffuseMap);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, specularMap);
-        glBindVertexArray(cubeVAO);
+        glState().bindTexture(0, GL_TEXTURE_2D, diffuseMap);
+        glState().bindTexture(1, GL_TEXTURE_2D, specularMap);
+        // the queue draws the cubes front to back
+        cubes.clear();
         for (unsigned int i = 0; i < sizeof(cubePositions)/sizeof(cubePositions[0]); i++) {
             glm::mat4 model = glm::mat4(1.0f);
             model = glm::translate(model, cubePositions[i]);
             float angle = 20.0f * i;
             model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-            lightingShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, sizeof(vertices)/8);
+            queue.add({ 0, &lightingShader, nullptr, cubeVAO, &cubes, cubes.add(model, 0, numVertices) },
+                      glm::length(cubePositions[i] - camera.position));
         }
+        queue.flush();
 
         // // render cube
         // lightCubeShader.use();
@@ -264,7 +258,7 @@ int main(void)
         // lightCubeShader.setMat4("model", model);
         //
         // glBindVertexArray(lightVAO);
-        // glDrawArrays(GL_TRIANGLES, 0, sizeof(vertices)/8);
+        // glDrawArrays(GL_TRIANGLES, 0, numVertices);
 
         glfwSwapBuffers(window);
         glfwPollEvents();
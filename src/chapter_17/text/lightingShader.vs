@@ -3,12 +3,12 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in mat4 model; // per instance, cf. instance_buffer.hpp
 
 out vec3 normal;
 out vec3 fragPos;
 out vec2 texCoord;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
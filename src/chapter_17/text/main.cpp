@@ -4,15 +4,18 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
 #include <iostream>
 #include <cmath>
+#include <vector>
 
 #include "common.hpp"
 #include "shader.hpp"
+#include "texture_loader.hpp"
 #include "camera.hpp"
+#include "instance_buffer.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
 
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 static void processInput(GLFWwindow *window);
@@ -26,6 +29,9 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
+// the first ten use cubePositions, any further ones are scattered in front of the camera
+const unsigned int NUM_CUBES = 100000;
+
 int main(void)
 {
     GLFWwindow* window;
@@ -67,8 +73,6 @@ int main(void)
     Shader lightCubeShader (STRING(SOURCE_DIR)"/lightCubeShader.vs", STRING(SOURCE_DIR)"/lightCubeShader.fs");
 
     std::string fname;
-    unsigned char *data;
-    int width, height, nrChannels;
 
 
     // set up diffuseMap texture
@@ -81,15 +85,10 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // generate texture and mimap
     fname = STRING(ASSETS_DIR)"container2.png";
-    data = stbi_load(fname.c_str(), &width, &height, &nrChannels, 0);
-    if (!data) {
+    if (!textureLoader().loadBound(fname, TextureLoader::CACHE | TextureLoader::FLIP_VERTICALLY | TextureLoader::SRGB)) {
         std::cout << "failed to load texture " << fname << std::endl;
         return -1;
     }
-    // note: .png is stored as RGBA
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data); data = nullptr;
 
     // set up diffuseMap texture
     unsigned int specularMap;
@@ -101,15 +100,10 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // generate texture and mimap
     fname = STRING(ASSETS_DIR)"container2_specular.png";
-    data = stbi_load(fname.c_str(), &width, &height, &nrChannels, 0);
-    if (!data) {
+    if (!textureLoader().loadBound(fname, TextureLoader::CACHE | TextureLoader::FLIP_VERTICALLY)) {
         std::cout << "failed to load texture " << fname << std::endl;
         return -1;
     }
-    // note: .png is stored as RGBA
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data); data = nullptr;
 
 
     // set up vertices for a cube
@@ -186,6 +180,34 @@ int main(void)
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(6*sizeof(float)));
     glEnableVertexAttribArray(2);
 
+    // every cube's model matrix goes into an instance buffer once, all cubes are drawn with
+    // a single call
+    std::vector<glm::mat4> cubeModels(NUM_CUBES);
+    const unsigned int numPositions = sizeof(cubePositions)/sizeof(cubePositions[0]);
+    for (unsigned int i = 0; i < NUM_CUBES; i++) {
+        glm::vec3 position;
+        if (i < numPositions) {
+            position = cubePositions[i];
+        } else {
+            // cheap deterministic scatter inside the initial view frustum: 5 to 95 units in front
+            // of the camera at (0, 0, 5), within the 45 degree, 4:3 field of view at that distance
+            unsigned int h = i * 2654435761u;
+            h = (h ^ h >> 15) * 2246822519u;
+            const float distance = 5.0f + (h >> 20 & 0x3ff) / 1023.0f * 90.0f;
+            position = glm::vec3(((h & 0x3ff) / 1023.0f * 2.0f - 1.0f) * 0.55f * distance,
+                                 ((h >> 10 & 0x3ff) / 1023.0f * 2.0f - 1.0f) * 0.41f * distance,
+                                 5.0f - distance);
+        }
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, position);
+        float angle = 20.0f * i;
+        model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+        cubeModels[i] = model;
+    }
+    InstanceBuffer cubeInstances;
+    cubeInstances.upload(cubeModels.data(), cubeModels.size());
+    cubeInstances.attach(cubeVAO);
+
     unsigned int lightVAO;
     glGenVertexArrays(1, &lightVAO);
 
@@ -284,7 +306,6 @@ int main(void)
 
         glm::mat4 view = camera.getViewMatrix();
         glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), 800.0f/600.0f, 0.1f, 100.0f);
-        glm::mat4 model = glm::mat4(1.0f);
         lightingShader.setMat4("view", view);
         lightingShader.setMat4("projection", projection);
 
@@ -293,14 +314,7 @@ int main(void)
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, specularMap);
         glBindVertexArray(cubeVAO);
-        for (unsigned int i = 0; i < sizeof(cubePositions)/sizeof(cubePositions[0]); i++) {
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, cubePositions[i]);
-            float angle = 20.0f * i;
-            model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-            lightingShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, sizeof(vertices)/8);
-        }
+        glDrawArraysInstanced(GL_TRIANGLES, 0, sizeof(vertices)/sizeof(vertices[0])/8, cubeInstances.size());
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -62,7 +62,6 @@ int main(void)
         std::cout << "failed to intialize GLAD" << std::endl;
         return -1;
     }
-    stbi_set_flip_vertically_on_load(true);
 
     glViewport(0, 0, 800, 600);
     glEnable(GL_DEPTH_TEST);
@@ -71,7 +70,9 @@ int main(void)
     Shader shader (STRING(SOURCE_DIR)"/shader.vs", STRING(SOURCE_DIR)"/shader.fs");
 
     std::string fname = STRING(ASSETS_DIR)"backpack/backpack.obj";
-    Model objModel(fname);
+    ModelLoadOptions options;
+    options.flipTextures = true;
+    Model objModel(fname, options);
 
     auto startPos = glm::vec3(0.0f, 0.0f, 5.0f);
     camera = Camera(startPos);
@@ -84,6 +85,7 @@ int main(void)
         lastFrame = currentFrame;
 
         processInput(window);
+        textureLoader().update();
 
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
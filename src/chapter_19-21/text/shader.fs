@@ -4,9 +4,13 @@ out vec4 fragColor;
 
 in vec2 texCoord;
 
-uniform sampler2D texture_diffuse1; // texture_diffuseNr is naming convetion from mesh.hpp
+// material.texture_diffuseNr is the naming convention from material.hpp
+struct Material {
+  sampler2D texture_diffuse1;
+};
+uniform Material material;
 
 void main()
 {
-  fragColor = texture(texture_diffuse1, texCoord);
+  fragColor = texture(material.texture_diffuse1, texCoord);
 }
@@ -11,6 +11,8 @@
 #include <sstream>
 #include <iostream>
 
+#include "gl_state.hpp"
+
 class Shader {
   public:
     unsigned int ID; // program id
@@ -83,7 +85,7 @@ class Shader {
       glDeleteShader(fragment);
     }
 
-    void use() { glUseProgram(ID); }
+    void use() { glState().useProgram(ID); }
 
     void setBool(const std::string &name, bool value) const {
       setInt(name, (int)value);
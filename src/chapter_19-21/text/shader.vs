@@ -7,11 +7,12 @@ layout (location = 2) in vec2 aTexCoord;
 out vec2 texCoord;
 
 uniform mat4 model;
+uniform mat4 node;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
   texCoord = aTexCoord;
-  gl_Position = projection * view * model * vec4(aPos, 1.0);
+  gl_Position = projection * view * model * node * vec4(aPos, 1.0);
 }
@@ -9,6 +9,7 @@
 
 #include "common.hpp"
 #include "shader.hpp"
+#include "texture_loader.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -50,10 +51,6 @@ int main(void)
 
     Shader shader (STRING(SOURCE_DIR)"/shader.vs", STRING(SOURCE_DIR)"/shader.fs");
 
-    int width, height, nrChannels;
-    unsigned char * data;
-    stbi_set_flip_vertically_on_load(true);
-
     // set up texture0
     // generate buffer
     unsigned int texture0;
@@ -67,15 +64,10 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // generate texture and mimap
     char fname1[] = STRING(ASSETS_DIR)"container.jpg";
-    data = stbi_load(fname1, &width, &height, &nrChannels, 0);
-    if (!data) {
+    if (!textureLoader().loadBound(fname1, TextureLoader::CACHE | TextureLoader::FLIP_VERTICALLY | TextureLoader::SRGB)) {
         std::cout << "failed to load texture " << fname1 << std::endl;
         return -1;
     }
-    // note: jpgpng is stored as RGB
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
 
     // set up texture1
     // generate buffer
@@ -90,15 +82,10 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // generate texture and mimap
     char fname2[] = STRING(ASSETS_DIR)"awesomeface.png";
-    data = stbi_load(fname2, &width, &height, &nrChannels, 0);
-    if (!data) {
+    if (!textureLoader().loadBound(fname2, TextureLoader::CACHE | TextureLoader::FLIP_VERTICALLY | TextureLoader::SRGB)) {
         std::cout << "failed to load texture " << fname2 << std::endl;
         return -1;
     }
-    // note: .png is stored as RGBA
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
 
     // set up vertices for the rectangle
     float vertices[] {
@@ -0,0 +1,151 @@
+#ifndef CONSTANT_RING_HPP
+#define CONSTANT_RING_HPP
+
+#include "glad/glad.h"
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "gl_ext.hpp"
+
+// the std140 uniform blocks of shader_ring.vs
+struct FrameConstants {
+    glm::mat4 view;
+    glm::mat4 projection;
+};
+struct DrawConstants {
+    glm::mat4 world;     // model * node
+    glm::vec4 posOffset; // dequantization, w is 1 for quantized meshes and 0 otherwise
+    glm::vec4 posScale;
+};
+
+// Shader constants written one after another into a buffer and bound as uniform blocks by
+// offset, one glBindBufferRange per block instead of a glUniform* per value. The buffer holds
+// FRAMES frames of frameBytes each. Where glExt().bufferStorage is loaded it is mapped
+// persistently and coherently once and a fence per frame keeps writes off the region the GPU
+// may still read. Otherwise writes go to memory, and a bind after new writes uploads the
+// frame in one glBufferData that orphans the storage in flight. GL thread only.
+class ConstantRing {
+public:
+    static constexpr unsigned int FRAMES = 3;
+    static constexpr GLuint FRAME_BINDING = 0;
+    static constexpr GLuint DRAW_BINDING = 1;
+
+    explicit ConstantRing(size_t frameBytes = 4 << 20)
+    {
+      GLint alignment = 0;
+      glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+      this->alignment = std::max<GLint>(alignment, 16);
+      this->frameBytes = (frameBytes + this->alignment - 1) / this->alignment * this->alignment;
+      glGenBuffers(1, &buffer);
+      glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+      if (glExt().bufferStorage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glExt().bufferStorage(GL_UNIFORM_BUFFER, FRAMES * this->frameBytes, nullptr, flags);
+        mapped = (uint8_t *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, FRAMES * this->frameBytes, flags);
+      }
+      if (!mapped) {
+        glBufferData(GL_UNIFORM_BUFFER, this->frameBytes, nullptr, GL_STREAM_DRAW);
+        staging.resize(this->frameBytes);
+      }
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    ConstantRing(const ConstantRing &) = delete;
+    ConstantRing &operator=(const ConstantRing &) = delete;
+    ~ConstantRing()
+    {
+      for (GLsync &fence : fences)
+        if (fence) glDeleteSync(fence);
+      if (mapped) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+      }
+      glDeleteBuffers(1, &buffer);
+    }
+
+    bool persistent() const { return mapped != nullptr; }
+    size_t capacity() const { return frameBytes; }
+    // of the current frame
+    size_t size() const { return used; }
+    // frames that had to wait for the GPU in beginFrame()
+    uint64_t stalls() const { return numStalls; }
+
+    // starts writing the next frame; the region it reuses was last drawn from FRAMES - 1
+    // frames ago, its fence is normally signalled by now
+    void beginFrame()
+    {
+      frame = (frame + 1) % FRAMES;
+      used = 0;
+      uploaded = 0;
+      GLsync &fence = fences[frame];
+      if (!fence) return;
+      if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        numStalls++;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+      }
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+
+    // copies size bytes into the current frame and returns the offset to bind them at
+    GLintptr write(const void *data, size_t size)
+    {
+      const size_t offset = used;
+      if (offset + size > frameBytes) {
+        std::cout << "ERROR::CONSTANT_RING::FRAME_FULL " << frameBytes << " bytes" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      used = std::min(frameBytes, (offset + size + alignment - 1) / alignment * alignment);
+      if (mapped) {
+        const size_t base = frame * frameBytes;
+        std::memcpy(mapped + base + offset, data, size);
+        return base + offset;
+      }
+      std::memcpy(staging.data() + offset, data, size);
+      return offset;
+    }
+    template <typename T>
+    GLintptr write(const T &value)
+    {
+      return write(&value, sizeof(T));
+    }
+
+    // binds [offset, +size) to the uniform block binding point, e.g. FRAME_BINDING
+    void bind(GLuint binding, GLintptr offset, size_t size)
+    {
+      if (!mapped && uploaded < used) {
+        // binds made before keep reading the orphaned storage
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, frameBytes, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, used, staging.data());
+        uploaded = used;
+      }
+      glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+    }
+
+    // call after the last draw that reads the current frame
+    void endFrame()
+    {
+      if (mapped) fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    unsigned int buffer = 0;
+    size_t frameBytes;
+    size_t alignment;
+    uint8_t *mapped = nullptr; // all FRAMES regions
+    std::vector<uint8_t> staging; // the current frame without buffer storage
+    GLsync fences[FRAMES] = {};
+    unsigned int frame = 0;
+    size_t used = 0;
+    size_t uploaded = 0;
+    uint64_t numStalls = 0;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <glm/glm.hpp>
+
+// The six clip planes of a projection matrix (Gribb and Hartmann). Built from
+// projection * view * model the planes are in the model's object space, so object space
+// bounds can be tested without transforming them.
+struct Frustum {
+    glm::vec4 planes[6]; // xyz is the unit inward normal, w the distance
+
+    explicit Frustum(const glm::mat4 &clip) {
+      for (int i = 0; i < 3; i++) {
+        const glm::vec4 row(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+        const glm::vec4 w(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+        planes[2 * i] = w + row;
+        planes[2 * i + 1] = w - row;
+      }
+      for (glm::vec4 &plane : planes) plane = plane / glm::length(glm::vec3(plane));
+    }
+
+    // false only if the sphere is completely outside one of the planes
+    bool intersects(const glm::vec3 &center, float radius) const {
+      for (const glm::vec4 &plane : planes)
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) return false;
+      return true;
+    }
+};
+
+#endif
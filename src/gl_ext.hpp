@@ -0,0 +1,84 @@
+#ifndef GL_EXT_HPP
+#define GL_EXT_HPP
+
+#include "glad/glad.h"
+
+#include <cstring>
+
+// The glad loader in this tree is plain GL 3.3 core without extensions. What the renderer
+// uses beyond that is declared here and only used after checking for it at runtime.
+
+// EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// ARB_buffer_storage, core since 4.4
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+
+// ARB_draw_indirect / ARB_multi_draw_indirect, core since 4.0 / 4.3
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+// the layout glMultiDrawElementsIndirect reads its commands in
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// true if the current context advertises name, needs a current context
+inline bool hasGlExtension(const char *name)
+{
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (extension && std::strcmp(extension, name) == 0) return true;
+  }
+  return false;
+}
+
+// true if the current context is at least major.minor
+inline bool hasGlVersion(int major, int minor)
+{
+  return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+// entry points beyond 3.3 core, null where the context lacks them
+struct GlExtensions {
+    void (APIENTRYP bufferStorage)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags) = nullptr;
+    // with base instances (4.2 / ARB_base_instance), so that baseInstance offsets instanced attributes
+    void (APIENTRYP multiDrawElementsIndirect)(GLenum mode, GLenum type, const void *indirect, GLsizei drawCount,
+        GLsizei stride) = nullptr;
+};
+
+inline GlExtensions &glExt()
+{
+  static GlExtensions extensions;
+  return extensions;
+}
+
+// fills glExt() with what the current context supports, call it once after gladLoadGL() with
+// the window system's loader, e.g. (GLADloadproc)glfwGetProcAddress
+inline void loadGlExtensions(GLADloadproc load)
+{
+  GlExtensions &ext = glExt();
+  if (hasGlVersion(4, 4) || hasGlExtension("GL_ARB_buffer_storage"))
+    ext.bufferStorage = (decltype(ext.bufferStorage))load("glBufferStorage");
+  if (hasGlVersion(4, 3) || (hasGlExtension("GL_ARB_multi_draw_indirect") && hasGlExtension("GL_ARB_base_instance")))
+    ext.multiDrawElementsIndirect = (decltype(ext.multiDrawElementsIndirect))load("glMultiDrawElementsIndirect");
+}
+
+#endif
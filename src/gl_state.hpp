@@ -0,0 +1,134 @@
+#ifndef GL_STATE_HPP
+#define GL_STATE_HPP
+
+#include "glad/glad.h"
+
+#include <cstdint>
+
+// Shadow of the binding state that drawing changes most: program, vertex array, active
+// texture unit and the 2D / 2D array texture of every unit. A call that would bind what is
+// already bound is skipped, issued() and skipped() count both kinds since resetCounters().
+// GL thread only. Code that binds these directly, bypassing the cache, has to call
+// invalidate() before the next call through it.
+class GlState {
+public:
+    static constexpr unsigned int MAX_UNITS = 32;
+
+    GlState() { invalidate(); }
+    GlState(const GlState &) = delete;
+    GlState &operator=(const GlState &) = delete;
+
+    void useProgram(unsigned int program)
+    {
+      if (count(this->program == program)) return;
+      this->program = program;
+      glUseProgram(program);
+    }
+
+    void bindVertexArray(unsigned int vao)
+    {
+      if (count(vertexArray == vao)) return;
+      vertexArray = vao;
+      glBindVertexArray(vao);
+    }
+
+    // unit is an index, not GL_TEXTURE0 + index
+    void activeTexture(unsigned int unit)
+    {
+      if (count(activeUnit == unit)) return;
+      activeUnit = unit;
+      glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // binds id to target of unit, the active unit only changes if the binding does
+    void bindTexture(unsigned int unit, GLenum target, unsigned int id)
+    {
+      const int slot = targetSlot(target);
+      if (slot >= 0 && unit < MAX_UNITS && textures[unit][slot] == id) {
+        skippedCalls++;
+        return;
+      }
+      activeTexture(unit);
+      bindTexture(target, id);
+    }
+
+    // binds id to target of the active unit, e.g. to specify its images
+    void bindTexture(GLenum target, unsigned int id)
+    {
+      const int slot = targetSlot(target);
+      if (slot >= 0 && activeUnit < MAX_UNITS) {
+        if (count(textures[activeUnit][slot] == id)) return;
+        textures[activeUnit][slot] = id;
+      } else {
+        issuedCalls++;
+      }
+      glBindTexture(target, id);
+    }
+
+    // GL unbinds deleted objects, call these after glDeleteTextures / glDeleteVertexArrays
+    void textureDeleted(unsigned int id)
+    {
+      for (unsigned int unit = 0; unit < MAX_UNITS; unit++)
+        for (unsigned int &bound : textures[unit])
+          if (bound == id) bound = 0;
+    }
+    void vertexArrayDeleted(unsigned int vao)
+    {
+      if (vertexArray == vao) vertexArray = 0;
+    }
+
+    // nothing is known to be bound afterwards, the next call of every kind is issued
+    void invalidate()
+    {
+      program = UNKNOWN;
+      vertexArray = UNKNOWN;
+      activeUnit = UNKNOWN;
+      for (unsigned int unit = 0; unit < MAX_UNITS; unit++)
+        for (unsigned int &bound : textures[unit]) bound = UNKNOWN;
+    }
+
+    uint64_t issued() const { return issuedCalls; }
+    uint64_t skipped() const { return skippedCalls; }
+    void resetCounters()
+    {
+      issuedCalls = 0;
+      skippedCalls = 0;
+    }
+
+private:
+    static constexpr unsigned int UNKNOWN = ~0u;
+
+    unsigned int program;
+    unsigned int vertexArray;
+    unsigned int activeUnit;
+    unsigned int textures[MAX_UNITS][2]; // GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY
+    uint64_t issuedCalls = 0;
+    uint64_t skippedCalls = 0;
+
+    // counts the call as skipped if it is redundant, as issued otherwise
+    bool count(bool redundant)
+    {
+      if (redundant) skippedCalls++;
+      else issuedCalls++;
+      return redundant;
+    }
+
+    // other targets are passed through untracked
+    static int targetSlot(GLenum target)
+    {
+      switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_2D_ARRAY: return 1;
+        default: return -1;
+      }
+    }
+};
+
+// process wide cache, the application has a single context
+inline GlState &glState()
+{
+  static GlState state;
+  return state;
+}
+
+#endif
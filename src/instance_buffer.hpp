@@ -0,0 +1,55 @@
+#ifndef INSTANCE_BUFFER_HPP
+#define INSTANCE_BUFFER_HPP
+
+#include "glad/glad.h"
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+#include "gl_state.hpp"
+
+// Per instance model matrices in a vertex buffer. A VAO that the buffer is attached to reads
+// them as a mat4 attribute (four vec4 locations starting at location) that advances once per
+// instance, so one instanced draw call replaces a setMat4("model", ...) and a draw per object.
+class InstanceBuffer {
+public:
+    static const GLuint LOCATION = 3;
+
+    // copies count matrices into the buffer; the storage only ever grows and is orphaned
+    // before it is refilled, so a frame in flight keeps reading the old contents
+    void upload(const glm::mat4 *instances, size_t count)
+    {
+      if (!vbo) glGenBuffers(1, &vbo);
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      if (count > capacity) capacity = count;
+      glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), instances);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      numInstances = count;
+    }
+
+    // points vao's instance attribute at the buffer, the VAO remembers it (the buffer name
+    // never changes, so once per VAO is enough); call upload() at least once before
+    void attach(GLuint vao, GLuint location = LOCATION) const
+    {
+      glState().bindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      for (GLuint column = 0; column < 4; column++) {
+        glEnableVertexAttribArray(location + column);
+        glVertexAttribPointer(location + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+            (void *)(column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location + column, 1);
+      }
+      glState().bindVertexArray(0);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    size_t size() const { return numInstances; }
+
+private:
+    unsigned int vbo = 0;
+    size_t capacity = 0;
+    size_t numInstances = 0;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef LOAD_TRACE_HPP
+#define LOAD_TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// Records timestamped spans of the loading code (nodes, meshes, texture decodes and
+// uploads, ...) from any thread into a fixed size buffer. Writers claim a slot with one
+// atomic increment and never wait on each other; once the buffer is full further spans are
+// only counted. The result can be written as Chrome trace JSON (chrome://tracing, Perfetto).
+// Nothing is printed unless verbose is set, then every span also logs one line when it ends.
+class LoadTrace {
+public:
+    static const size_t DETAIL_LENGTH = 56;
+
+    LoadTrace() : epoch(std::chrono::steady_clock::now()) {}
+    LoadTrace(const LoadTrace &) = delete;
+    LoadTrace &operator=(const LoadTrace &) = delete;
+
+    std::atomic<bool> verbose{false};
+
+    // starts recording into a fresh buffer, call it while nothing is being loaded
+    void start(size_t capacity = 1 << 16)
+    {
+      recording = false;
+      events.reset(new Event[capacity]);
+      this->capacity = capacity;
+      next = 0;
+      droppedEvents = 0;
+      recording = true;
+    }
+    void stop() { recording = false; }
+
+    // spans are only worth building while one of these is true
+    bool active() const
+    {
+      return recording.load(std::memory_order_relaxed) || verbose.load(std::memory_order_relaxed);
+    }
+
+    // nanoseconds since the trace was created
+    uint64_t now() const
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // category and name have to be string literals, detail is copied (and may be null)
+    void record(const char *category, const char *name, const char *detail, uint64_t startNs, uint64_t endNs)
+    {
+      if (verbose.load(std::memory_order_relaxed)) log(category, name, detail, endNs - startNs);
+      if (!recording.load(std::memory_order_relaxed)) return;
+      const size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+      if (slot >= capacity) {
+        droppedEvents.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      Event &event = events[slot];
+      event.category = category;
+      event.name = name;
+      event.startNs = startNs;
+      event.durationNs = endNs - startNs;
+      event.thread = threadIndex();
+      event.detail[0] = '\0';
+      if (detail) {
+        std::strncpy(event.detail, detail, DETAIL_LENGTH - 1);
+        event.detail[DETAIL_LENGTH - 1] = '\0';
+      }
+      event.ready.store(true, std::memory_order_release);
+    }
+
+    size_t size() const { return std::min(next.load(), capacity); }
+    size_t dropped() const { return droppedEvents.load(); }
+
+    // events that are still being written when this runs are left out
+    void writeChromeTrace(std::ostream &out) const
+    {
+      out << "{\"traceEvents\":[";
+      bool first = true;
+      char number[64];
+      for (size_t i = 0; i < size(); i++) {
+        const Event &event = events[i];
+        if (!event.ready.load(std::memory_order_acquire)) continue;
+        out << (first ? "\n" : ",\n");
+        first = false;
+        std::snprintf(number, sizeof(number), "\"ts\":%.3f,\"dur\":%.3f", event.startNs * 1e-3, event.durationNs * 1e-3);
+        out << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\","
+            << number << ",\"pid\":1,\"tid\":" << event.thread;
+        if (event.detail[0]) {
+          out << ",\"args\":{\"detail\":\"";
+          writeEscaped(out, event.detail);
+          out << "\"}";
+        }
+        out << "}";
+      }
+      out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+    bool writeChromeTrace(const std::string &file) const
+    {
+      std::ofstream out(file);
+      if (!out) return false;
+      writeChromeTrace(out);
+      return (bool)out;
+    }
+
+private:
+    struct Event {
+        const char *category;
+        const char *name;
+        uint64_t startNs;
+        uint64_t durationNs;
+        uint32_t thread;
+        char detail[DETAIL_LENGTH];
+        std::atomic<bool> ready{false};
+    };
+
+    const std::chrono::steady_clock::time_point epoch;
+    std::unique_ptr<Event[]> events;
+    size_t capacity = 0;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> droppedEvents{0};
+    std::atomic<bool> recording{false};
+
+    // small stable numbers for the trace viewer's rows, in order of first use
+    static uint32_t threadIndex()
+    {
+      static std::atomic<uint32_t> count{0};
+      thread_local const uint32_t index = count++;
+      return index;
+    }
+
+    static void log(const char *category, const char *name, const char *detail, uint64_t durationNs)
+    {
+      // one write per line so that lines from different threads do not mix
+      char line[DETAIL_LENGTH + 128];
+      std::snprintf(line, sizeof(line), "%s %s %s (%.3f ms)\n", category, name, detail ? detail : "", durationNs * 1e-6);
+      std::cout << line;
+    }
+
+    static void writeEscaped(std::ostream &out, const char *text)
+    {
+      for (; *text; text++) {
+        const unsigned char c = *text;
+        if (c == '"' || c == '\\')
+          out << '\\' << c;
+        else if (c < 0x20)
+          out << ' ';
+        else
+          out << c;
+      }
+    }
+};
+
+// process wide trace, all loaders record into it
+inline LoadTrace &loadTrace()
+{
+  static LoadTrace trace;
+  return trace;
+}
+
+// records the time between its construction and destruction into loadTrace(),
+// detail has to stay valid for the span's lifetime
+class TraceSpan {
+public:
+    TraceSpan(const char *category, const char *name, const char *detail = nullptr)
+      : category(category), name(name), detail(detail), startNs(loadTrace().active() ? loadTrace().now() : NOT_ACTIVE) {}
+    TraceSpan(const char *category, const char *name, const std::string &detail)
+      : TraceSpan(category, name, detail.c_str()) {}
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+    ~TraceSpan()
+    {
+      if (startNs != NOT_ACTIVE) loadTrace().record(category, name, detail, startNs, loadTrace().now());
+    }
+
+private:
+    static const uint64_t NOT_ACTIVE = ~0ull;
+    const char *category;
+    const char *name;
+    const char *detail;
+    const uint64_t startNs;
+};
+
+#endif
@@ -1,5 +1,6 @@
 // Compile with -O3 to speed up obj loading
 // Also: need to unpack assets/backpack.zip into assets/backpack first
+// The first run writes assets/backpack/backpack.obj.meshcache, later runs skip the Assimp import
 
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
@@ -9,11 +10,14 @@
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 #include "common.hpp"
 #include "shader.hpp"
 #include "camera.hpp"
 #include "model.hpp"
+#include "render_queue.hpp"
+#include "constant_ring.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -62,45 +66,68 @@ int main(void)
         std::cout << "failed to intialize GLAD" << std::endl;
         return -1;
     }
-    stbi_set_flip_vertically_on_load(true);
+    loadGlExtensions((GLADloadproc)glfwGetProcAddress);
 
     glViewport(0, 0, 800, 600);
     glEnable(GL_DEPTH_TEST);
 
 
-    Shader shader (STRING(SOURCE_DIR)"/shader.vs", STRING(SOURCE_DIR)"/shader.fs");
+    Shader shader (STRING(SOURCE_DIR)"/shader_ring.vs", STRING(SOURCE_DIR)"/shader_array.fs");
+    shader.setBlockBinding("Frame", ConstantRing::FRAME_BINDING);
+    shader.setBlockBinding("Draw", ConstantRing::DRAW_BINDING);
 
-    std::string fname = STRING(ASSETS_DIR)"backpack/backpack.obj";
-    Model objModel(fname);
-
-    auto startPos = glm::vec3(0.0f, 0.0f, 5.0f);
-    camera = Camera(startPos);
-
-    /* Loop until the user closes the window */
-    while (!glfwWindowShouldClose(window))
+    // the model and the ring delete textures, buffers and fences, which needs the context
     {
-        const float currentFrame = (float)glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-
-        processInput(window);
-
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        shader.use();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), 800.0f / 600.0f, 0.1f, 100.0f);
-        glm::mat4 view = camera.getViewMatrix();
-        shader.setMat4("projection", projection);
-        shader.setMat4("view", view);
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
-        model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));	// it's a bit too big for our scene, so scale it down
-        shader.setMat4("model", model);
-        objModel.draw(shader);
-
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        std::string fname = STRING(ASSETS_DIR)"backpack/backpack.obj";
+        ModelLoadOptions options;
+        options.generateLods = true;
+        options.cullMeshlets = true;
+        options.streaming = true;
+        options.releaseCpuData = true;
+        options.compressTextures = true;
+        options.flipTextures = true;
+        options.textureArrays = true;
+        Model objModel(fname, options);
+
+        auto startPos = glm::vec3(0.0f, 0.0f, 5.0f);
+        camera = Camera(startPos);
+        RenderQueue queue;
+        ConstantRing constants;
+
+        /* Loop until the user closes the window */
+        while (!glfwWindowShouldClose(window))
+        {
+            const float currentFrame = (float)glfwGetTime();
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+
+            processInput(window);
+            textureLoader().update();
+            objModel.update();
+
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            // the window may have been resized, the LOD error is measured in its pixels
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            height = std::max(height, 1);
+            glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), (float)width / height, 0.1f, 100.0f);
+            glm::mat4 view = camera.getViewMatrix();
+            glm::mat4 model = glm::mat4(1.0f);
+            model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
+            model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));	// it's a bit too big for our scene, so scale it down
+            // all constants of the frame are written before the first bind uploads them
+            constants.beginFrame();
+            const GLintptr frame = constants.write(FrameConstants{ view, projection });
+            objModel.enqueue(queue, shader, DrawView{ model, view, projection, camera.position, (float)height }, 1.0f, &constants);
+            constants.bind(ConstantRing::FRAME_BINDING, frame, sizeof(FrameConstants));
+            queue.flush();
+            constants.endFrame();
+
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
     }
 
     glfwTerminate();
@@ -0,0 +1,48 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string &path) {
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) return false;
+      struct stat st;
+      if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+      }
+      void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      // the mapping stays valid after the descriptor is closed
+      ::close(fd);
+      if (ptr == MAP_FAILED) return false;
+      data = (const unsigned char *)ptr;
+      size = st.st_size;
+      return true;
+    }
+
+    void close() {
+      if (data) munmap((void *)data, size);
+      data = nullptr;
+      size = 0;
+    }
+};
+
+#endif
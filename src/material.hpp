@@ -0,0 +1,92 @@
+#ifndef MATERIAL_HPP
+#define MATERIAL_HPP
+
+#include "glad/glad.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gl_state.hpp"
+#include "shader.hpp"
+
+struct Texture {
+    unsigned int id;
+    std::string type;
+    std::string path;
+    int layer = -1; // of id as a GL_TEXTURE_2D_ARRAY, -1 if id is a GL_TEXTURE_2D
+};
+
+// The textures of one mesh resolved against one shader program. textures[i] goes to unit i
+// and is sampled through "material.<type><n>" (n counts the textures of each type from 1),
+// array layers are passed in "material.<type><n>_layer". The uniform locations are looked up
+// once here, bind() allocates nothing and looks nothing up, its binds go through glState().
+class Material {
+public:
+    Material() = default;
+    Material(const Shader &shader, const std::vector<Texture> &textures) : programId(shader.ID) {
+      unsigned int diffuseNr = 1;
+      unsigned int specularNr = 1;
+      for (const Texture &texture : textures) {
+        std::string number;
+        if (texture.type == "texture_diffuse")
+          number = std::to_string(diffuseNr++);
+        else if (texture.type == "texture_specular")
+          number = std::to_string(specularNr++);
+        const std::string uniform = "material." + texture.type + number;
+        Slot slot;
+        slot.id = texture.id;
+        slot.target = texture.layer >= 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+        slot.layer = texture.layer;
+        slot.sampler = glGetUniformLocation(programId, uniform.c_str());
+        slot.layerLocation = texture.layer >= 0 ? glGetUniformLocation(programId, (uniform + "_layer").c_str()) : -1;
+        slots.push_back(slot);
+        // FNV-1a over the bound names
+        for (unsigned int value : { slot.id, (unsigned int)slot.target }) key = (key ^ value) * 16777619u;
+      }
+    }
+
+    // the program the locations belong to, 0 if nothing was resolved
+    unsigned int program() const { return programId; }
+    size_t size() const { return slots.size(); }
+    // 16 bits that agree for materials which bind the same textures (layers aside), for sorting
+    uint16_t bindingKey() const { return (uint16_t)(key ^ key >> 16); }
+
+    // whether bind() would leave the same state behind as other.bind(), layers included
+    bool bindsSameAs(const Material &other) const {
+      if (programId != other.programId || key != other.key || slots.size() != other.slots.size()) return false;
+      for (size_t i = 0; i < slots.size(); i++) {
+        const Slot &a = slots[i], &b = other.slots[i];
+        if (a.id != b.id || a.target != b.target || a.layer != b.layer || a.sampler != b.sampler
+            || a.layerLocation != b.layerLocation)
+          return false;
+      }
+      return true;
+    }
+
+    // expects program() to be in use, leaves unit 0 active
+    void bind() const {
+      for (size_t i = 0; i < slots.size(); i++) {
+        const Slot &slot = slots[i];
+        if (slot.sampler >= 0) glUniform1i(slot.sampler, i);
+        if (slot.layerLocation >= 0) glUniform1i(slot.layerLocation, slot.layer);
+        glState().bindTexture(i, slot.target, slot.id);
+      }
+      glState().activeTexture(0);
+    }
+
+private:
+    struct Slot {
+      unsigned int id;
+      GLenum target;
+      int layer;
+      GLint sampler; // -1 where the shader does not use the texture
+      GLint layerLocation;
+    };
+
+    unsigned int programId = 0;
+    std::vector<Slot> slots;
+    uint32_t key = 2166136261u;
+};
+
+#endif
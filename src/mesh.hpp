@@ -4,89 +4,331 @@
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "gl_state.hpp"
+#include "material.hpp"
 #include "shader.hpp"
 
-struct Vertex {
+// 16 byte aligned so that vertex arrays can be filled with aligned SIMD stores
+struct alignas(16) Vertex {
     glm::vec3 position;
     glm::vec3 normal;
     glm::vec2 texCoord;
 };
+static_assert(sizeof(Vertex) == 32 && offsetof(Vertex, normal) == 12 && offsetof(Vertex, texCoord) == 24,
+    "Vertex has to stay tightly packed, setupMesh and the mesh cache rely on it");
 
-struct Texture {
-    unsigned int id;
+// texture a mesh refers to before it is loaded into GL
+struct TextureRef {
     std::string type;
     std::string path;
 };
 
+// one level of detail, an index range into the mesh's index array; error is the largest
+// deviation from the full detail surface in object space units
+struct LodLevel {
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    float error;
+};
+
+// cluster of neighbouring triangles, indices[firstIndex, +numIndices), with object space
+// bounds for culling; coneCutoff is the cosine of the normal cone's half angle
+struct Meshlet {
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// non-owning view of one mesh's arrays, e.g. into a MeshData or a mapped mesh cache
+struct MeshView {
+    const Vertex *vertices;
+    size_t numVertices;
+    const unsigned int *indices;
+    size_t numIndices;
+    const LodLevel *lods;
+    size_t numLods;
+    const Meshlet *meshlets;
+    size_t numMeshlets;
+    int node;
+    std::vector<TextureRef> textures;
+};
+
+// CPU side result of converting one aiMesh, can be produced off the GL thread
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<TextureRef> textures;
+    // empty unless generateLods() ran, the coarser levels are appended to indices
+    std::vector<LodLevel> lods;
+    // empty unless buildMeshlets() ran, covers the full detail indices
+    std::vector<Meshlet> meshlets;
+    // scene graph node the mesh is attached to, -1 if it is not
+    int node = -1;
+
+    MeshView view() const {
+      return { vertices.data(), vertices.size(), indices.data(), indices.size(), lods.data(), lods.size(),
+               meshlets.data(), meshlets.size(), node, textures };
+    }
+};
+
+// compact alternative to Vertex, 16 instead of 32 bytes
+struct PackedVertex {
+    uint16_t position[4]; // unorm, dequantized with the mesh bounds, [3] is padding
+    int16_t normal[2];    // snorm octahedral encoding
+    uint16_t texCoord[2]; // half float
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex has to stay tightly packed");
+
+// index range of a Mesh drawn as one glDrawElements, indices are relative to baseVertex
+struct SubMesh {
+    size_t firstIndex;
+    size_t numIndices;
+    int baseVertex;
+};
+
 class Mesh {
 public:
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture> textures;
+    // a single part spanning all indices unless the mesh was merged from several
+    std::vector<SubMesh> parts;
+    // levels of detail from fine to coarse, empty if the mesh has none
+    std::vector<LodLevel> lods;
+    // clusters of the full detail level, empty if the mesh has none
+    std::vector<Meshlet> meshlets;
+    // scene graph node whose world matrix places the mesh, -1 for none
+    int node = -1;
+    // object space bounding box of all vertices
+    glm::vec3 boundsMin, boundsMax;
 
-    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+    // pass the vectors as rvalues to hand them over without a copy,
+    // quantize uploads PackedVertex and, if every index fits, 16 bit indices
+    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures,
+         std::vector<SubMesh> parts = std::vector<SubMesh>(), bool quantize = false)
     {
-      this->vertices = vertices;
-      this->indices = indices;
-      this->textures = textures;
+      this->vertices = std::move(vertices);
+      this->indices = std::move(indices);
+      this->textures = std::move(textures);
+      this->parts = std::move(parts);
 
-      setupMesh();
+      setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size(), quantize);
+    }
+    // uploads straight from caller owned memory (e.g. a mapped mesh cache) without keeping a CPU copy
+    Mesh(const Vertex *vertices, size_t numVertices, const unsigned int *indices, size_t numIndices,
+         std::vector<Texture> textures, bool quantize = false)
+    {
+      this->textures = std::move(textures);
+
+      setupMesh(vertices, numVertices, indices, numIndices, quantize);
     }
     void draw(Shader &shader)
     {
-      unsigned int diffuseNr = 1;
-      unsigned int specularNr = 1;
-      for (unsigned int i = 0; i < textures.size(); i++) {
-        glActiveTexture(GL_TEXTURE0 + i);
-        std::string number;
-        std::string name  = textures[i].type;
-        if (name == "texture_diffuse")
-          number = std::to_string(diffuseNr++);
-        else if (name == "texture_specular")
-          number = std::to_string(specularNr++);
-
-        shader.setFloat(("material." + name + number).c_str(), i);
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+      if (material.program() != shader.ID) material = Material(shader, textures);
+      material.bind();
+
+      // shader.vs places meshes below their scene graph node, which only Model tracks
+      shader.setMat4("node", glm::mat4(1.0f));
+      shader.setBool("quantized", quantized);
+      if (quantized) {
+        shader.setVec3("posOffset", positionOffset());
+        shader.setVec3("posScale", positionScale());
       }
-      glActiveTexture(GL_TEXTURE0);
 
-      glBindVertexArray(VAO);
-      glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-      glBindVertexArray(0);
+      glState().bindVertexArray(VAO);
+      for (const SubMesh &part : parts) {
+        glDrawElementsBaseVertex(GL_TRIANGLES, part.numIndices, indexType,
+            (void *)(part.firstIndex * indexSize()), part.baseVertex);
+      }
+    }
+    // call after changing textures, draw() resolves them against its shader again
+    void resetMaterial() { material = Material(); }
+    // the single part is narrowed to the full detail level, draw() keeps drawing that one
+    void setLods(std::vector<LodLevel> lods)
+    {
+      this->lods = std::move(lods);
+      if (!this->lods.empty() && parts.size() == 1) parts[0].numIndices = this->lods[0].numIndices;
+    }
+    // hands the CPU copies of the vertices and indices over to the caller and frees them here,
+    // the GPU buffers, textures, bounds, levels of detail and meshlets stay; view() is empty afterwards
+    MeshData releaseCpuData()
+    {
+      MeshData data;
+      data.vertices.swap(vertices);
+      data.indices.swap(indices);
+      for (const Texture &texture : textures) data.textures.push_back({ texture.type, texture.path });
+      data.lods = lods;
+      data.meshlets = meshlets;
+      data.node = node;
+      return data;
+    }
+    // bytes held in this object's arrays
+    size_t cpuBytes() const
+    {
+      return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int)
+           + textures.capacity() * sizeof(Texture) + parts.capacity() * sizeof(SubMesh)
+           + lods.capacity() * sizeof(LodLevel) + meshlets.capacity() * sizeof(Meshlet);
+    }
+    // bytes of the vertex and index buffers as uploaded
+    size_t gpuBytes() const { return bufferBytes; }
+    unsigned int vao() const { return VAO; }
+    unsigned int vertexBuffer() const { return VBO; }
+    unsigned int indexBuffer() const { return EBO; }
+    size_t vertexCount() const { return numVertices; }
+    // bytes per vertex in vertexBuffer()
+    size_t vertexSize() const { return quantized ? sizeof(PackedVertex) : sizeof(Vertex); }
+    size_t indexCount() const { return numIndices; }
+    bool isQuantized() const { return quantized; }
+    GLenum indexFormat() const { return indexType; }
+    size_t indexSize() const { return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int); }
+    // position = posOffset + quantized position * posScale, see shader.vs
+    glm::vec3 positionOffset() const { return boundsMin; }
+    glm::vec3 positionScale() const { return boundsMax - boundsMin; }
+    MeshView view() const {
+      MeshView view = { vertices.data(), vertices.size(), indices.data(), indices.size(), lods.data(), lods.size(),
+                        meshlets.data(), meshlets.size(), node, {} };
+      for (const Texture &texture : textures) view.textures.push_back({ texture.type, texture.path });
+      return view;
+    }
+    // points attributes 0 to 2 of the bound VAO at the bound vertex buffer, which holds Vertex
+    // or, if packed, PackedVertex
+    static void setupAttributes(bool packed)
+    {
+      if (packed) {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, position));
+
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, normal));
+
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, texCoord));
+        return;
+      }
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, position));
+
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+
+      glEnableVertexAttribArray(2);
+      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, texCoord));
     }
 private:
     unsigned int VAO, VBO, EBO;
+    Material material; // textures as resolved against the shader of the last draw()
+    size_t numVertices;
+    size_t numIndices;
+    size_t bufferBytes;
+    bool quantized;
+    GLenum indexType;
 
-    void setupMesh()
+    void setupMesh(const Vertex *vertices, size_t numVertices, const unsigned int *indices, size_t numIndices,
+        bool quantize)
     {
+      this->numVertices = numVertices;
+      this->numIndices = numIndices;
+      if (parts.empty()) parts.push_back({ 0, numIndices, 0 });
+      computeBounds(vertices, numVertices);
+      quantized = quantize;
+
       glGenVertexArrays(1, &VAO);
       glGenBuffers(1, &VBO);
       glGenBuffers(1, &EBO);
 
-      glBindVertexArray(VAO);
+      glState().bindVertexArray(VAO);
       glBindBuffer(GL_ARRAY_BUFFER, VBO);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 
-      glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-          vertices.data(), GL_STATIC_DRAW);
+      if (quantize) {
+        setupPacked(vertices, numVertices, indices, numIndices);
+        glState().bindVertexArray(0);
+        return;
+      }
+      indexType = GL_UNSIGNED_INT;
 
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-      glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-          indices.data(), GL_STATIC_DRAW);
+      glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
+          vertices, GL_STATIC_DRAW);
+      bufferBytes = numVertices * sizeof(Vertex) + numIndices * sizeof(unsigned int);
 
-      glEnableVertexAttribArray(0);
-      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, position));
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int),
+          indices, GL_STATIC_DRAW);
 
-      glEnableVertexAttribArray(1);
-      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+      setupAttributes(false);
 
-      glEnableVertexAttribArray(2);
-      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, texCoord));
+      // element buffers bound later must not end up in this VAO
+      glState().bindVertexArray(0);
+    }
+
+    void computeBounds(const Vertex *vertices, size_t numVertices)
+    {
+      boundsMin = boundsMax = numVertices ? vertices[0].position : glm::vec3(0.0f);
+      for (size_t i = 1; i < numVertices; i++) {
+        boundsMin = glm::min(boundsMin, vertices[i].position);
+        boundsMax = glm::max(boundsMax, vertices[i].position);
+      }
+    }
+
+    // expects VAO, VBO and EBO to be bound
+    void setupPacked(const Vertex *vertices, size_t numVertices, const unsigned int *indices, size_t numIndices)
+    {
+      const glm::vec3 extent = positionScale();
+      const glm::vec3 invExtent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                                extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                                extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+      std::vector<PackedVertex> packed(numVertices);
+      for (size_t i = 0; i < numVertices; i++) {
+        const Vertex &vertex = vertices[i];
+        const glm::vec3 unit = (vertex.position - boundsMin) * invExtent;
+        for (int k = 0; k < 3; k++) packed[i].position[k] = (uint16_t)std::lround(std::clamp(unit[k], 0.0f, 1.0f) * 65535.0f);
+        packed[i].position[3] = 0;
+        const glm::vec2 oct = octEncode(vertex.normal);
+        for (int k = 0; k < 2; k++) packed[i].normal[k] = (int16_t)std::lround(std::clamp(oct[k], -1.0f, 1.0f) * 32767.0f);
+        for (int k = 0; k < 2; k++) packed[i].texCoord[k] = glm::packHalf1x16(vertex.texCoord[k]);
+      }
+      glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+      bufferBytes = numVertices * sizeof(PackedVertex);
+
+      // base vertices keep indices local to their part, so the largest index decides
+      const unsigned int maxIndex = numIndices ? *std::max_element(indices, indices + numIndices) : 0;
+      if (maxIndex <= 0xFFFF) {
+        indexType = GL_UNSIGNED_SHORT;
+        std::vector<uint16_t> shortIndices(indices, indices + numIndices);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+        bufferBytes += numIndices * sizeof(uint16_t);
+      } else {
+        indexType = GL_UNSIGNED_INT;
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+        bufferBytes += numIndices * sizeof(unsigned int);
+      }
 
-      glBindVertexArray(0);
+      setupAttributes(true);
+    }
+
+    // maps a unit vector onto the [-1,1] square, inverse of octDecode in shader.vs
+    static glm::vec2 octEncode(const glm::vec3 &n)
+    {
+      const float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+      if (l1 == 0.0f) return glm::vec2(0.0f, 0.0f);
+      glm::vec2 p(n.x / l1, n.y / l1);
+      if (n.z < 0.0f) {
+        p = glm::vec2((1.0f - std::fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - std::fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+      }
+      return p;
     }
 };
 
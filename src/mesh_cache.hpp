@@ -0,0 +1,249 @@
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "scene_graph.hpp"
+
+// Binary cache of the final Vertex/index/material arrays that Model builds from an Assimp
+// import, so that warm loads can skip Assimp completely.
+//
+// file layout (host byte order, every section starts on a 16 byte boundary):
+//   MeshCacheHeader
+//   for each scene graph node: MeshCacheNode, then the name chars
+//   for each mesh:
+//     MeshCacheEntry
+//     Vertex[numVertices]
+//     unsigned int[numIndices]
+//     LodLevel[numLods]
+//     Meshlet[numMeshlets]
+//     for each texture: uint32_t typeLength, uint32_t pathLength, then type chars and path chars
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t vertexSize;
+    uint64_t key;
+    uint32_t numMeshes;
+    uint32_t numNodes;
+};
+
+struct MeshCacheNode {
+    int32_t parent;
+    uint32_t nameLength;
+    uint32_t reserved[2];
+    float local[16]; // column major
+};
+
+struct MeshCacheEntry {
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numTextures;
+    uint32_t numLods;
+    uint32_t numMeshlets;
+    int32_t node;
+    uint32_t reserved[2];
+};
+
+class MeshCache {
+public:
+    // bump whenever the layout or the content of Vertex changes
+    static constexpr uint32_t VERSION = 5;
+
+    // processing steps that change the cached arrays, part of the key
+    enum Pipeline : uint32_t {
+      OPTIMIZED = 1 << 0,
+      LODS = 1 << 1,
+      MESHLETS = 1 << 2,
+    };
+
+    // views into the mapped file, valid as long as this MeshCache lives
+    std::vector<MeshView> entries;
+    // the node hierarchy the entries refer to, a copy
+    SceneGraph graph;
+
+    static std::string cachePath(const std::string &path) {
+      return path + ".meshcache";
+    }
+
+    // hash of the source file contents, the import flags, the Pipeline flags and the cache format,
+    // returns 0 if the source file cannot be read
+    static uint64_t makeKey(const std::string &path, unsigned int importFlags, uint32_t pipeline = 0) {
+      MappedFile source;
+      if (!source.open(path)) return 0;
+      uint64_t hash = fnv1a(14695981039346656037ull, source.data, source.size);
+      const uint32_t extra[4] = { importFlags, pipeline, VERSION, (uint32_t)sizeof(Vertex) };
+      hash = fnv1a(hash, (const unsigned char *)extra, sizeof(extra));
+      return hash ? hash : 1;
+    }
+
+    // maps cacheFile and validates it against key, fills entries on success
+    bool open(const std::string &cacheFile, uint64_t key) {
+      entries.clear();
+      if (key == 0 || !file.open(cacheFile)) return false;
+
+      size_t offset = 0;
+      const MeshCacheHeader *header = (const MeshCacheHeader *)read(offset, sizeof(MeshCacheHeader));
+      if (!header
+          || std::memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0
+          || header->version != VERSION
+          || header->vertexSize != sizeof(Vertex)
+          || header->key != key) {
+        return fail();
+      }
+
+      graph = SceneGraph();
+      for (uint32_t i = 0; i < header->numNodes; i++) {
+        const MeshCacheNode *node = (const MeshCacheNode *)read(offset, sizeof(MeshCacheNode));
+        if (!node || node->parent < -1 || node->parent >= (int32_t)i) return fail();
+        const char *name = (const char *)read(offset, node->nameLength);
+        if (!name) return fail();
+        glm::mat4 local;
+        std::memcpy(&local[0][0], node->local, sizeof(node->local));
+        graph.addNode(node->parent, local, std::string(name, node->nameLength));
+      }
+
+      entries.reserve(header->numMeshes);
+      for (uint32_t i = 0; i < header->numMeshes; i++) {
+        const MeshCacheEntry *raw = (const MeshCacheEntry *)read(offset, sizeof(MeshCacheEntry));
+        if (!raw) return fail();
+        MeshView entry;
+        entry.numVertices = raw->numVertices;
+        entry.numIndices = raw->numIndices;
+        entry.numLods = raw->numLods;
+        entry.numMeshlets = raw->numMeshlets;
+        entry.node = raw->node;
+        if (entry.node < -1 || entry.node >= (int)graph.size()) return fail();
+        entry.vertices = (const Vertex *)read(offset, (size_t)raw->numVertices * sizeof(Vertex));
+        entry.indices = (const unsigned int *)read(offset, (size_t)raw->numIndices * sizeof(unsigned int));
+        entry.lods = (const LodLevel *)read(offset, (size_t)raw->numLods * sizeof(LodLevel));
+        entry.meshlets = (const Meshlet *)read(offset, (size_t)raw->numMeshlets * sizeof(Meshlet));
+        if (!entry.vertices || !entry.indices || !entry.lods || !entry.meshlets) return fail();
+        if (!validContents(entry)) return fail();
+        for (uint32_t j = 0; j < raw->numTextures; j++) {
+          const uint32_t *lengths = (const uint32_t *)read(offset, 2 * sizeof(uint32_t));
+          if (!lengths) return fail();
+          const char *chars = (const char *)read(offset, (size_t)lengths[0] + lengths[1]);
+          if (!chars) return fail();
+          entry.textures.push_back({ std::string(chars, lengths[0]),
+                                     std::string(chars + lengths[0], lengths[1]) });
+        }
+        entries.push_back(std::move(entry));
+      }
+      return true;
+    }
+
+    // writes meshes through a temporary file so that a crash never leaves a truncated cache behind
+    static bool write(const std::string &cacheFile, uint64_t key, const std::vector<MeshView> &meshes,
+        const SceneGraph &graph) {
+      const std::string tmpFile = cacheFile + ".tmp";
+      std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+      if (!out) return false;
+
+      MeshCacheHeader header = {};
+      std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+      header.version = VERSION;
+      header.vertexSize = sizeof(Vertex);
+      header.key = key;
+      header.numMeshes = meshes.size();
+      header.numNodes = graph.size();
+      put(out, &header, sizeof(header));
+
+      for (size_t i = 0; i < graph.size(); i++) {
+        MeshCacheNode node = {};
+        node.parent = graph.parents[i];
+        node.nameLength = graph.names[i].size();
+        std::memcpy(node.local, &graph.locals[i][0][0], sizeof(node.local));
+        put(out, &node, sizeof(node));
+        put(out, graph.names[i].data(), graph.names[i].size());
+      }
+
+      for (const MeshView &mesh : meshes) {
+        MeshCacheEntry entry = {};
+        entry.numVertices = mesh.numVertices;
+        entry.numIndices = mesh.numIndices;
+        entry.numTextures = mesh.textures.size();
+        entry.numLods = mesh.numLods;
+        entry.numMeshlets = mesh.numMeshlets;
+        entry.node = mesh.node;
+        put(out, &entry, sizeof(entry));
+        put(out, mesh.vertices, mesh.numVertices * sizeof(Vertex));
+        put(out, mesh.indices, mesh.numIndices * sizeof(unsigned int));
+        put(out, mesh.lods, mesh.numLods * sizeof(LodLevel));
+        put(out, mesh.meshlets, mesh.numMeshlets * sizeof(Meshlet));
+        for (const TextureRef &texture : mesh.textures) {
+          const uint32_t lengths[2] = { (uint32_t)texture.type.size(), (uint32_t)texture.path.size() };
+          put(out, lengths, sizeof(lengths));
+          out.write(texture.type.data(), texture.type.size());
+          put(out, texture.path.data(), texture.path.size());
+        }
+      }
+      out.close();
+      if (!out || std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+        std::remove(tmpFile.c_str());
+        return false;
+      }
+      return true;
+    }
+
+private:
+    static constexpr char MAGIC[8] = { 'L', 'O', 'G', 'L', 'M', 'E', 'S', 'H' };
+
+    MappedFile file;
+
+    static uint64_t fnv1a(uint64_t hash, const unsigned char *data, size_t size) {
+      for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+      }
+      return hash;
+    }
+
+    static size_t pad(size_t size) { return (size + 15) & ~(size_t)15; }
+
+    // returns a pointer to the next size bytes and advances offset past the section's padding,
+    // nullptr if the file is too short
+    const void *read(size_t &offset, size_t size) {
+      if (offset > file.size || file.size - offset < size) return nullptr;
+      const void *ptr = file.data + offset;
+      offset = pad(offset + size);
+      return ptr;
+    }
+
+    // whether every index names a vertex and every LOD and meshlet range lies within the
+    // indices, so that a stale or corrupt cache falls back to an import instead of drawing
+    // out of bounds
+    static bool validContents(const MeshView &mesh) {
+      for (size_t i = 0; i < mesh.numIndices; i++)
+        if (mesh.indices[i] >= mesh.numVertices) return false;
+      for (size_t i = 0; i < mesh.numLods; i++)
+        if ((uint64_t)mesh.lods[i].firstIndex + mesh.lods[i].numIndices > mesh.numIndices) return false;
+      for (size_t i = 0; i < mesh.numMeshlets; i++)
+        if ((uint64_t)mesh.meshlets[i].firstIndex + mesh.meshlets[i].numIndices > mesh.numIndices) return false;
+      return true;
+    }
+
+    // writes data and zero pads the stream to the next 16 byte boundary
+    static void put(std::ofstream &out, const void *data, size_t size) {
+      static const char zeros[16] = {};
+      out.write((const char *)data, size);
+      const std::streamoff pos = out.tellp();
+      out.write(zeros, pad(pos) - pos);
+    }
+
+    bool fail() {
+      entries.clear();
+      graph = SceneGraph();
+      file.close();
+      return false;
+    }
+};
+
+#endif
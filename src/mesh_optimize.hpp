@@ -0,0 +1,265 @@
+#ifndef MESH_OPTIMIZE_HPP
+#define MESH_OPTIMIZE_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+// Index and vertex reordering for MeshData, applied in this order by optimizeMesh():
+//   1. optimizeVertexCache: Forsyth's "Linear-Speed Vertex Cache Optimisation"
+//   2. optimizeOverdraw: splits the result into clusters at cache restarts and sorts the
+//      clusters so that outward facing ones are drawn first, similar to Sander et al.
+//   3. optimizeVertexFetch: renumbers vertices in order of first use
+// None of them change the set of triangles or their winding.
+
+// result of replaying an index buffer through a FIFO post-transform cache
+struct VertexCacheStats {
+    size_t misses = 0;
+    size_t triangles = 0;
+    size_t vertices = 0; // referenced vertices
+
+    // average cache miss ratio, transformed vertices per triangle (0.5 is the ideal for big grids)
+    float acmr() const { return triangles ? (float)misses / triangles : 0.0f; }
+    // average transform to vertex ratio, 1.0 means every vertex is transformed exactly once
+    float atvr() const { return vertices ? (float)misses / vertices : 0.0f; }
+
+    VertexCacheStats &operator+=(const VertexCacheStats &other) {
+      misses += other.misses;
+      triangles += other.triangles;
+      vertices += other.vertices;
+      return *this;
+    }
+};
+
+struct MeshOptimizeStats {
+    VertexCacheStats before;
+    VertexCacheStats after;
+
+    MeshOptimizeStats &operator+=(const MeshOptimizeStats &other) {
+      before += other.before;
+      after += other.after;
+      return *this;
+    }
+};
+
+inline VertexCacheStats analyzeVertexCache(const unsigned int *indices, size_t numIndices, size_t numVertices,
+    unsigned int cacheSize = 16)
+{
+  VertexCacheStats stats;
+  stats.triangles = numIndices / 3;
+  // timestamps[v] is the miss count at which v entered the cache, a vertex is still
+  // cached while fewer than cacheSize misses happened since then
+  std::vector<size_t> timestamps(numVertices, 0);
+  std::vector<bool> seen(numVertices, false);
+  for (size_t i = 0; i < numIndices; i++) {
+    const unsigned int v = indices[i];
+    if (!seen[v]) {
+      seen[v] = true;
+      stats.vertices++;
+    }
+    if (timestamps[v] == 0 || stats.misses + 1 - timestamps[v] > cacheSize) {
+      stats.misses++;
+      timestamps[v] = stats.misses;
+    }
+  }
+  return stats;
+}
+
+inline void optimizeVertexCache(std::vector<unsigned int> &indices, size_t numVertices)
+{
+  const size_t numTriangles = indices.size() / 3;
+  if (numTriangles == 0) return;
+  // the scoring cache is bigger than the hardware one, the algorithm is not sensitive to it
+  const int cacheSize = 32;
+
+  // triangles adjacent to each vertex, compacted as triangles get emitted
+  std::vector<unsigned int> valence(numVertices, 0);
+  for (unsigned int v : indices) valence[v]++;
+  std::vector<unsigned int> adjacencyOffset(numVertices + 1, 0);
+  for (size_t v = 0; v < numVertices; v++) adjacencyOffset[v + 1] = adjacencyOffset[v] + valence[v];
+  std::vector<unsigned int> adjacency(indices.size());
+  {
+    std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t t = 0; t < numTriangles; t++)
+      for (int k = 0; k < 3; k++) adjacency[fill[indices[3 * t + k]]++] = t;
+  }
+
+  auto vertexScore = [&](int cachePosition, unsigned int remaining) {
+    if (remaining == 0) return -1.0f;
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+      // the last triangle's vertices get a fixed score so that strips do not just turn around
+      if (cachePosition < 3)
+        score = 0.75f;
+      else
+        score = std::pow(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+    }
+    // prefer vertices with few triangles left so that they get retired early
+    return score + 2.0f / std::sqrt((float)remaining);
+  };
+
+  std::vector<int> cachePosition(numVertices, -1);
+  std::vector<float> vertexScores(numVertices);
+  for (size_t v = 0; v < numVertices; v++) vertexScores[v] = vertexScore(-1, valence[v]);
+  std::vector<float> triangleScores(numTriangles);
+  for (size_t t = 0; t < numTriangles; t++)
+    triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+
+  std::vector<bool> emitted(numTriangles, false);
+  std::vector<unsigned int> output;
+  output.reserve(indices.size());
+  std::vector<unsigned int> cache, nextCache;
+  cache.reserve(cacheSize + 3);
+  nextCache.reserve(cacheSize + 3);
+  size_t scanPosition = 0; // fallback when no cached vertex has triangles left
+
+  long best = 0;
+  while (best >= 0) {
+    emitted[best] = true;
+    const unsigned int *tri = &indices[3 * best];
+    output.insert(output.end(), tri, tri + 3);
+
+    // move the triangle's vertices to the front of the LRU cache and retire the triangle
+    nextCache.assign(tri, tri + 3);
+    for (unsigned int v : cache)
+      if (v != tri[0] && v != tri[1] && v != tri[2]) nextCache.push_back(v);
+    for (int k = 0; k < 3; k++) {
+      const unsigned int v = tri[k];
+      unsigned int *begin = &adjacency[adjacencyOffset[v]];
+      unsigned int *end = begin + valence[v];
+      *std::find(begin, end, (unsigned int)best) = *(end - 1);
+      valence[v]--;
+    }
+
+    // rescore everything that was or is in the cache, then pick the best touched triangle;
+    // picking while rescoring would compare triangles that are only partly updated
+    for (unsigned int v : cache) cachePosition[v] = -1;
+    for (size_t i = 0; i < nextCache.size(); i++) cachePosition[nextCache[i]] = i < (size_t)cacheSize ? i : -1;
+    for (unsigned int v : nextCache) {
+      const float delta = vertexScore(cachePosition[v], valence[v]) - vertexScores[v];
+      vertexScores[v] += delta;
+      for (unsigned int j = adjacencyOffset[v]; j < adjacencyOffset[v] + valence[v]; j++)
+        triangleScores[adjacency[j]] += delta;
+    }
+    best = -1;
+    float bestScore = -1.0f;
+    for (unsigned int v : nextCache) {
+      for (unsigned int j = adjacencyOffset[v]; j < adjacencyOffset[v] + valence[v]; j++) {
+        const unsigned int t = adjacency[j];
+        if (triangleScores[t] > bestScore) {
+          bestScore = triangleScores[t];
+          best = t;
+        }
+      }
+    }
+    if (nextCache.size() > (size_t)cacheSize) nextCache.resize(cacheSize);
+    std::swap(cache, nextCache);
+
+    if (best < 0) {
+      while (scanPosition < numTriangles && emitted[scanPosition]) scanPosition++;
+      if (scanPosition < numTriangles) best = scanPosition;
+    }
+  }
+  indices.swap(output);
+}
+
+inline void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<Vertex> &vertices,
+    unsigned int cacheSize = 16)
+{
+  const size_t numTriangles = indices.size() / 3;
+  if (numTriangles < 2) return;
+
+  // a cluster ends where all three vertices of a triangle miss the cache, cutting there
+  // keeps the vertex cache efficiency of the previous pass intact
+  std::vector<size_t> clusterStart;
+  std::vector<size_t> timestamps(vertices.size(), 0);
+  size_t misses = 0;
+  for (size_t t = 0; t < numTriangles; t++) {
+    int triangleMisses = 0;
+    for (int k = 0; k < 3; k++) {
+      const unsigned int v = indices[3 * t + k];
+      if (timestamps[v] == 0 || misses + 1 - timestamps[v] > cacheSize) {
+        timestamps[v] = ++misses;
+        triangleMisses++;
+      }
+    }
+    if (t == 0 || triangleMisses == 3) clusterStart.push_back(t);
+  }
+  clusterStart.push_back(numTriangles);
+  const size_t numClusters = clusterStart.size() - 1;
+  if (numClusters < 2) return;
+
+  // draw clusters that face away from the mesh center first, they are the likeliest occluders
+  glm::vec3 meshCenter(0.0f);
+  float meshArea = 0.0f;
+  std::vector<glm::vec3> clusterCenter(numClusters, glm::vec3(0.0f));
+  std::vector<glm::vec3> clusterNormal(numClusters, glm::vec3(0.0f));
+  std::vector<float> clusterArea(numClusters, 0.0f);
+  for (size_t c = 0; c < numClusters; c++) {
+    for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++) {
+      const glm::vec3 &a = vertices[indices[3 * t]].position;
+      const glm::vec3 &b = vertices[indices[3 * t + 1]].position;
+      const glm::vec3 &d = vertices[indices[3 * t + 2]].position;
+      const glm::vec3 normal = glm::cross(b - a, d - a); // length is twice the area
+      const float area = glm::length(normal);
+      clusterCenter[c] += (a + b + d) * (area / 3.0f);
+      clusterNormal[c] += normal;
+      clusterArea[c] += area;
+    }
+    meshCenter += clusterCenter[c];
+    meshArea += clusterArea[c];
+  }
+  if (meshArea > 0.0f) meshCenter /= meshArea;
+
+  std::vector<float> sortKey(numClusters);
+  std::vector<size_t> order(numClusters);
+  for (size_t c = 0; c < numClusters; c++) {
+    const glm::vec3 center = clusterArea[c] > 0.0f ? clusterCenter[c] / clusterArea[c] : meshCenter;
+    const float normalLength = glm::length(clusterNormal[c]);
+    const glm::vec3 normal = normalLength > 0.0f ? clusterNormal[c] / normalLength : glm::vec3(0.0f);
+    sortKey[c] = glm::dot(center - meshCenter, normal);
+    order[c] = c;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+  std::vector<unsigned int> output;
+  output.reserve(indices.size());
+  for (size_t c : order)
+    output.insert(output.end(), indices.begin() + 3 * clusterStart[c], indices.begin() + 3 * clusterStart[c + 1]);
+  indices.swap(output);
+}
+
+// unreferenced vertices are dropped
+inline void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(vertices.size(), unused);
+  std::vector<Vertex> output;
+  output.reserve(vertices.size());
+  for (unsigned int &index : indices) {
+    if (remap[index] == unused) {
+      remap[index] = output.size();
+      output.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices.swap(output);
+}
+
+inline MeshOptimizeStats optimizeMesh(MeshData &data)
+{
+  MeshOptimizeStats stats;
+  stats.before = analyzeVertexCache(data.indices.data(), data.indices.size(), data.vertices.size());
+  optimizeVertexCache(data.indices, data.vertices.size());
+  optimizeOverdraw(data.indices, data.vertices);
+  optimizeVertexFetch(data.vertices, data.indices);
+  stats.after = analyzeVertexCache(data.indices.data(), data.indices.size(), data.vertices.size());
+  return stats;
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef MESH_SIMPLIFY_HPP
+#define MESH_SIMPLIFY_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "mesh.hpp"
+#include "mesh_optimize.hpp"
+
+// Quadric error edge collapse after Garland and Heckbert. Vertices only ever collapse onto
+// one of their neighbours, so every level of detail shares the vertex buffer of the
+// original mesh and only needs its own index range. Border edges (which in split-vertex
+// meshes also include uv and normal seams) are locked to avoid cracks.
+
+struct Quadric {
+    double a2 = 0, b2 = 0, c2 = 0, ab = 0, ac = 0, bc = 0, ad = 0, bd = 0, cd = 0, d2 = 0;
+    double weight = 0;
+
+    // plane n.p + d = 0 with unit normal n
+    void addPlane(const glm::vec3 &n, float d, float w) {
+      a2 += w * n.x * n.x; b2 += w * n.y * n.y; c2 += w * n.z * n.z;
+      ab += w * n.x * n.y; ac += w * n.x * n.z; bc += w * n.y * n.z;
+      ad += w * n.x * d; bd += w * n.y * d; cd += w * n.z * d;
+      d2 += w * d * d;
+      weight += w;
+    }
+
+    Quadric &operator+=(const Quadric &o) {
+      a2 += o.a2; b2 += o.b2; c2 += o.c2; ab += o.ab; ac += o.ac; bc += o.bc;
+      ad += o.ad; bd += o.bd; cd += o.cd; d2 += o.d2; weight += o.weight;
+      return *this;
+    }
+
+    // weighted mean squared distance of p to the accumulated planes
+    double error(const glm::vec3 &p) const {
+      const double x = p.x, y = p.y, z = p.z;
+      const double e = a2 * x * x + b2 * y * y + c2 * z * z
+                     + 2.0 * (ab * x * y + ac * x * z + bc * y * z)
+                     + 2.0 * (ad * x + bd * y + cd * z) + d2;
+      return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+    }
+};
+
+// returns indices with at most (roughly) targetIndexCount entries, error receives the largest
+// collapse error as a distance in object space units
+inline std::vector<unsigned int> simplifyMesh(const std::vector<unsigned int> &indices, const std::vector<Vertex> &vertices,
+    size_t targetIndexCount, float &error)
+{
+  const size_t numVertices = vertices.size();
+  std::vector<unsigned int> result(indices);
+  error = 0.0f;
+
+  std::vector<Quadric> quadrics(numVertices);
+  for (size_t t = 0; t + 2 < result.size(); t += 3) {
+    const glm::vec3 &a = vertices[result[t]].position;
+    const glm::vec3 normal = glm::cross(vertices[result[t + 1]].position - a, vertices[result[t + 2]].position - a);
+    const float length = glm::length(normal);
+    if (length == 0.0f) continue;
+    const glm::vec3 n = normal / length;
+    for (int k = 0; k < 3; k++) quadrics[result[t + k]].addPlane(n, -glm::dot(n, a), 0.5f * length);
+  }
+
+  // an edge is on the border if its reverse is not part of any triangle
+  std::vector<bool> locked(numVertices, false);
+  {
+    std::unordered_set<uint64_t> directed;
+    directed.reserve(result.size());
+    for (size_t t = 0; t + 2 < result.size(); t += 3)
+      for (int k = 0; k < 3; k++) directed.insert((uint64_t)result[t + k] << 32 | result[t + (k + 1) % 3]);
+    for (uint64_t edge : directed) {
+      const unsigned int a = edge >> 32, b = edge & 0xFFFFFFFF;
+      if (!directed.count((uint64_t)b << 32 | a)) locked[a] = locked[b] = true;
+    }
+  }
+
+  struct Collapse {
+    unsigned int from, to;
+    double cost;
+  };
+  std::vector<Collapse> collapses;
+  std::vector<unsigned int> remap(numVertices);
+  std::vector<bool> touched(numVertices);
+  std::vector<unsigned int> adjacencyOffset(numVertices + 1), adjacency;
+  double maxCost = 0.0;
+
+  while (result.size() > targetIndexCount) {
+    // every edge once, with the cheaper of its two collapse directions
+    collapses.clear();
+    for (size_t t = 0; t + 2 < result.size(); t += 3) {
+      for (int k = 0; k < 3; k++) {
+        const unsigned int a = result[t + k], b = result[t + (k + 1) % 3];
+        if (a > b || (locked[a] && locked[b])) continue;
+        Quadric q = quadrics[a];
+        q += quadrics[b];
+        const double toB = locked[a] ? INFINITY : q.error(vertices[b].position);
+        const double toA = locked[b] ? INFINITY : q.error(vertices[a].position);
+        collapses.push_back(toB <= toA ? Collapse{ a, b, toB } : Collapse{ b, a, toA });
+      }
+    }
+    if (collapses.empty()) break;
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+    // triangles around each vertex, for the flip test
+    std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+    for (unsigned int v : result) adjacencyOffset[v + 1]++;
+    for (size_t v = 0; v < numVertices; v++) adjacencyOffset[v + 1] += adjacencyOffset[v];
+    adjacency.resize(result.size());
+    {
+      std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+      for (size_t i = 0; i < result.size(); i++) adjacency[fill[result[i]]++] = i / 3;
+    }
+
+    for (size_t v = 0; v < numVertices; v++) remap[v] = v;
+    std::fill(touched.begin(), touched.end(), false);
+    const size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+    size_t removed = 0;
+    for (const Collapse &collapse : collapses) {
+      if (removed >= trianglesToRemove) break;
+      if (touched[collapse.from] || touched[collapse.to]) continue;
+
+      // reject collapses that would turn a triangle around
+      bool flips = false;
+      const glm::vec3 &target = vertices[collapse.to].position;
+      for (unsigned int j = adjacencyOffset[collapse.from]; j < adjacencyOffset[collapse.from + 1] && !flips; j++) {
+        const unsigned int *tri = &result[3 * adjacency[j]];
+        if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) continue;
+        glm::vec3 p[3], q[3];
+        for (int k = 0; k < 3; k++) {
+          p[k] = vertices[tri[k]].position;
+          q[k] = tri[k] == collapse.from ? target : p[k];
+        }
+        flips = glm::dot(glm::cross(p[1] - p[0], p[2] - p[0]), glm::cross(q[1] - q[0], q[2] - q[0])) <= 0.0f;
+      }
+      if (flips) continue;
+
+      // the one-ring of from changes shape, keep it out of further collapses in this pass
+      for (unsigned int j = adjacencyOffset[collapse.from]; j < adjacencyOffset[collapse.from + 1]; j++) {
+        const unsigned int *tri = &result[3 * adjacency[j]];
+        touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+        if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) removed++;
+      }
+      touched[collapse.to] = true;
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to] += quadrics[collapse.from];
+      maxCost = std::max(maxCost, collapse.cost);
+    }
+
+    size_t write = 0;
+    for (size_t t = 0; t + 2 < result.size(); t += 3) {
+      const unsigned int a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+      if (a == b || b == c || a == c) continue;
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    if (write == result.size()) break; // nothing collapsed, the rest is locked or would flip
+    result.resize(write);
+  }
+
+  error = (float)std::sqrt(maxCost);
+  return result;
+}
+
+// appends up to maxLevels coarser index ranges (halving the triangle count each time) to
+// data.indices and describes all of them in data.lods, lods[0] is the original mesh
+inline void generateLods(MeshData &data, int maxLevels = 3, bool optimize = false)
+{
+  const size_t baseCount = data.indices.size();
+  data.lods.assign(1, { 0, (uint32_t)baseCount, 0.0f });
+  const std::vector<unsigned int> base(data.indices);
+  size_t previousCount = baseCount;
+  for (int level = 1; level <= maxLevels; level++) {
+    // simplify from the original every time so that errors are measured against it
+    float error;
+    std::vector<unsigned int> lod = simplifyMesh(base, data.vertices, previousCount / 2 / 3 * 3, error);
+    // stop once simplification gets stuck, an almost identical level only costs memory
+    if (lod.empty() || lod.size() > previousCount * 9 / 10) break;
+    if (optimize) optimizeVertexCache(lod, data.vertices.size());
+    data.lods.push_back({ (uint32_t)data.indices.size(), (uint32_t)lod.size(), std::max(error, data.lods.back().error) });
+    data.indices.insert(data.indices.end(), lod.begin(), lod.end());
+    previousCount = lod.size();
+  }
+}
+
+#endif
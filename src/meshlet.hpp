@@ -0,0 +1,160 @@
+#ifndef MESHLET_HPP
+#define MESHLET_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+// Splits an index buffer into small clusters of neighbouring triangles that can be culled
+// one by one. Clusters grow greedily from a seed over shared vertices, preferring triangles
+// that add few new vertices and face the way the cluster already does, which keeps both
+// the bounding spheres and the normal cones tight.
+
+// how many new vertices one unit of normal deviation (1 - cos) is worth when growing a cluster
+const float MESHLET_CONE_WEIGHT = 0.5f;
+
+inline std::vector<Meshlet> buildMeshlets(std::vector<unsigned int> &indices, const std::vector<Vertex> &vertices,
+    size_t maxVertices = 64, size_t maxTriangles = 126)
+{
+  const size_t numVertices = vertices.size();
+  const size_t numTriangles = indices.size() / 3;
+  std::vector<Meshlet> meshlets;
+  if (numTriangles == 0) return meshlets;
+
+  std::vector<unsigned int> adjacencyOffset(numVertices + 1, 0);
+  for (unsigned int v : indices) adjacencyOffset[v + 1]++;
+  for (size_t v = 0; v < numVertices; v++) adjacencyOffset[v + 1] += adjacencyOffset[v];
+  std::vector<unsigned int> adjacency(indices.size());
+  {
+    std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) adjacency[fill[indices[i]]++] = i / 3;
+  }
+
+  // unit normals, zero for degenerate triangles
+  std::vector<glm::vec3> normals(numTriangles);
+  for (size_t t = 0; t < numTriangles; t++) {
+    const glm::vec3 &a = vertices[indices[3 * t]].position;
+    const glm::vec3 normal = glm::cross(vertices[indices[3 * t + 1]].position - a, vertices[indices[3 * t + 2]].position - a);
+    const float length = glm::length(normal);
+    normals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+  }
+
+  std::vector<bool> used(numTriangles, false);
+  std::vector<unsigned int> vertexMeshlet(numVertices, ~0u); // last meshlet that contains the vertex
+  std::vector<unsigned int> candidates;
+  std::vector<unsigned int> output;
+  output.reserve(indices.size());
+  size_t scanPosition = 0;
+
+  for (;;) {
+    while (scanPosition < numTriangles && used[scanPosition]) scanPosition++;
+    if (scanPosition == numTriangles) break;
+
+    const unsigned int id = meshlets.size();
+    const size_t start = output.size();
+    size_t meshletVertices = 0;
+    glm::vec3 normalSum(0.0f);
+    candidates.clear();
+
+    long next = scanPosition;
+    while (next >= 0) {
+      used[next] = true;
+      for (int k = 0; k < 3; k++) {
+        const unsigned int v = indices[3 * next + k];
+        output.push_back(v);
+        if (vertexMeshlet[v] != id) {
+          vertexMeshlet[v] = id;
+          meshletVertices++;
+        }
+        for (unsigned int j = adjacencyOffset[v]; j < adjacencyOffset[v + 1]; j++)
+          if (!used[adjacency[j]]) candidates.push_back(adjacency[j]);
+      }
+      normalSum += normals[next];
+      if ((output.size() - start) / 3 == maxTriangles) break;
+
+      const float axisLength = glm::length(normalSum);
+      const glm::vec3 axis = axisLength > 0.0f ? normalSum / axisLength : glm::vec3(0.0f);
+      next = -1;
+      float bestScore = INFINITY;
+      size_t live = 0;
+      for (unsigned int t : candidates) {
+        if (used[t]) continue;
+        candidates[live++] = t;
+        size_t newVertices = 0;
+        for (int k = 0; k < 3; k++) newVertices += vertexMeshlet[indices[3 * t + k]] != id;
+        if (meshletVertices + newVertices > maxVertices) continue;
+        const float score = newVertices + MESHLET_CONE_WEIGHT * (1.0f - glm::dot(axis, normals[t]));
+        if (score < bestScore) {
+          bestScore = score;
+          next = t;
+        }
+      }
+      candidates.resize(live);
+
+      // nothing connected is left, unconnected triangles that come next in the buffer are
+      // usually still close by
+      if (live == 0 && meshletVertices + 3 <= maxVertices) {
+        while (scanPosition < numTriangles && used[scanPosition]) scanPosition++;
+        if (scanPosition < numTriangles) next = scanPosition;
+      }
+    }
+
+    Meshlet meshlet;
+    meshlet.firstIndex = start;
+    meshlet.numIndices = output.size() - start;
+
+    glm::vec3 boundsMin = vertices[output[start]].position, boundsMax = boundsMin;
+    for (size_t i = start; i < output.size(); i++) {
+      boundsMin = glm::min(boundsMin, vertices[output[i]].position);
+      boundsMax = glm::max(boundsMax, vertices[output[i]].position);
+    }
+    meshlet.center = 0.5f * (boundsMin + boundsMax);
+    meshlet.radius = 0.0f;
+    for (size_t i = start; i < output.size(); i++)
+      meshlet.radius = std::max(meshlet.radius, glm::length(vertices[output[i]].position - meshlet.center));
+
+    // the cone has to contain every triangle normal, a half angle of 90 degrees or more
+    // means the cluster can be seen from anywhere
+    glm::vec3 axis(0.0f);
+    for (size_t i = start; i < output.size(); i += 3) {
+      const glm::vec3 &a = vertices[output[i]].position;
+      const glm::vec3 normal = glm::cross(vertices[output[i + 1]].position - a, vertices[output[i + 2]].position - a);
+      const float length = glm::length(normal);
+      if (length > 0.0f) axis += normal / length;
+    }
+    const float axisLength = glm::length(axis);
+    meshlet.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = axisLength > 0.0f ? 1.0f : -1.0f;
+    for (size_t i = start; i < output.size(); i += 3) {
+      const glm::vec3 &a = vertices[output[i]].position;
+      const glm::vec3 normal = glm::cross(vertices[output[i + 1]].position - a, vertices[output[i + 2]].position - a);
+      const float length = glm::length(normal);
+      if (length > 0.0f) meshlet.coneCutoff = std::min(meshlet.coneCutoff, glm::dot(meshlet.coneAxis, normal / length));
+    }
+    meshlets.push_back(meshlet);
+  }
+  indices.swap(output);
+  return meshlets;
+}
+
+// true if every triangle of the meshlet faces away from eye, both in the same space
+inline bool meshletBackfacing(const Meshlet &meshlet, const glm::vec3 &eye)
+{
+  if (meshlet.coneCutoff <= 0.0f) return false;
+  // the normal closest to the view direction is (cone half angle) away from the axis, the
+  // cluster faces away if even that one sees the whole bounding sphere from behind
+  const glm::vec3 toCenter = meshlet.center - eye;
+  const float distance = glm::length(toCenter);
+  if (distance <= meshlet.radius) return false;
+  const float cosView = glm::dot(toCenter, meshlet.coneAxis) / distance;
+  const float sinView = std::sqrt(std::max(0.0f, 1.0f - cosView * cosView));
+  const float sinCone = std::sqrt(std::max(0.0f, 1.0f - meshlet.coneCutoff * meshlet.coneCutoff));
+  return distance * (cosView * meshlet.coneCutoff - sinView * sinCone) >= meshlet.radius;
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef MIPMAP_HPP
+#define MIPMAP_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "texture_file.hpp"
+#include "thread_pool.hpp"
+
+// Mip chains on the CPU with a 2x2 box filter, the same on every driver. Rows are widened to
+// 12 bit before they are summed, for sRGB colour data through the sRGB transfer curve so that
+// the averages are taken in linear light (alpha is always linear). Like glGenerateMipmap,
+// odd sizes round down and drop the last texel row/column; a side of 1 is averaged with itself.
+
+struct MipChain {
+    std::vector<unsigned char> data; // every level below the source, tightly packed
+    std::vector<TextureLevel> levels; // views into data, largest first
+};
+
+namespace mip {
+
+struct SrgbTables {
+    uint16_t toLinear[256]; // 8 bit sRGB to 12 bit linear
+    uint8_t toSrgb[4096];
+
+    SrgbTables() {
+      for (int i = 0; i < 256; i++) {
+        const double c = i / 255.0;
+        const double l = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+        toLinear[i] = (uint16_t)std::lround(l * 4095.0);
+      }
+      for (int i = 0; i < 4096; i++) {
+        const double l = i / 4095.0;
+        const double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+        toSrgb[i] = (uint8_t)std::lround(c * 255.0);
+      }
+    }
+};
+
+inline const SrgbTables &srgbTables()
+{
+  static const SrgbTables tables;
+  return tables;
+}
+
+// one source row to 12 bit, linear channels are scaled by 16
+inline void widenRow(const unsigned char *row, size_t count, int channels, bool srgb, uint16_t *out)
+{
+  if (srgb) {
+    const uint16_t *toLinear = srgbTables().toLinear;
+    const bool alpha = channels == 2 || channels == 4;
+    for (size_t i = 0; i < count; i++)
+      out[i] = alpha && i % channels == (size_t)channels - 1 ? row[i] << 4 : toLinear[row[i]];
+    return;
+  }
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    const __m128i bytes = _mm_loadu_si128((const __m128i *)(row + i));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_slli_epi16(_mm_unpacklo_epi8(bytes, zero), 4));
+    _mm_storeu_si128((__m128i *)(out + i + 8), _mm_slli_epi16(_mm_unpackhi_epi8(bytes, zero), 4));
+  }
+#endif
+  for (; i < count; i++) out[i] = row[i] << 4;
+}
+
+inline void addRows(uint16_t *a, const uint16_t *b, size_t count)
+{
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 8 <= count; i += 8) {
+    const __m128i sum = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+    _mm_storeu_si128((__m128i *)(a + i), sum);
+  }
+#endif
+  for (; i < count; i++) a[i] += b[i];
+}
+
+// destination rows [firstRow, lastRow) of the level below src
+inline void downsampleRows(const unsigned char *src, int width, int height, int channels, bool srgb,
+    unsigned char *dst, int firstRow, int lastRow)
+{
+  const int dstWidth = std::max(1, width / 2);
+  const size_t rowCount = (size_t)width * channels;
+  std::vector<uint16_t> top(rowCount), bottom(rowCount);
+  const uint8_t *toSrgb = srgbTables().toSrgb;
+  const int alphaChannel = channels == 2 || channels == 4 ? channels - 1 : -1;
+  for (int y = firstRow; y < lastRow; y++) {
+    const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+    widenRow(src + y0 * rowCount, rowCount, channels, srgb, top.data());
+    widenRow(src + y1 * rowCount, rowCount, channels, srgb, bottom.data());
+    addRows(top.data(), bottom.data(), rowCount);
+    unsigned char *out = dst + (size_t)y * dstWidth * channels;
+    for (int x = 0; x < dstWidth; x++) {
+      const uint16_t *p0 = &top[(size_t)std::min(2 * x, width - 1) * channels];
+      const uint16_t *p1 = &top[(size_t)std::min(2 * x + 1, width - 1) * channels];
+      for (int c = 0; c < channels; c++) {
+        const unsigned int sum = p0[c] + p1[c]; // four 12 bit values
+        out[x * channels + c] = srgb && c != alphaChannel ? toSrgb[(sum + 2) >> 2] : (sum + 32) >> 6;
+      }
+    }
+  }
+}
+
+} // namespace mip
+
+// every level below the width x height image down to 1x1, with a pool each level is split
+// into bands of rows that its workers filter in parallel (do not pass the pool whose task is
+// calling, tasks must not wait on their own pool)
+inline MipChain generateMipChain(const unsigned char *pixels, int width, int height, int channels, bool srgb,
+    ThreadPool *pool = nullptr)
+{
+  MipChain chain;
+  std::vector<std::pair<int, int>> sizes;
+  size_t total = 0;
+  for (int w = width, h = height; w > 1 || h > 1;) {
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+    sizes.emplace_back(w, h);
+    total += (size_t)w * h * channels;
+  }
+  chain.data.resize(total);
+
+  const int BAND_ROWS = 32;
+  std::vector<std::future<void>> pending;
+  const unsigned char *src = pixels;
+  size_t offset = 0;
+  for (const auto &size : sizes) {
+    unsigned char *dst = chain.data.data() + offset;
+    const int rows = size.second;
+    if (!pool || rows <= BAND_ROWS) {
+      mip::downsampleRows(src, width, height, channels, srgb, dst, 0, rows);
+    } else {
+      for (int first = 0; first < rows; first += BAND_ROWS) {
+        const int last = std::min(first + BAND_ROWS, rows);
+        pending.push_back(pool->submit([=]() { mip::downsampleRows(src, width, height, channels, srgb, dst, first, last); }));
+      }
+      // the next level reads this one
+      for (std::future<void> &band : pending) band.get();
+      pending.clear();
+    }
+    const size_t bytes = (size_t)size.first * size.second * channels;
+    chain.levels.push_back({ size.first, size.second, dst, bytes });
+    src = dst;
+    width = size.first;
+    height = size.second;
+    offset += bytes;
+  }
+  return chain;
+}
+
+#endif
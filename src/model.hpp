@@ -2,169 +2,1177 @@
 #define MODEL_HPP
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <future>
+#include <algorithm>
+#include <chrono>
+#include <memory>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
-#include "std_image.h"
-
 #include "shader.hpp"
 #include "mesh.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimize.hpp"
+#include "mesh_simplify.hpp"
+#include "meshlet.hpp"
+#include "frustum.hpp"
+#include "gl_ext.hpp"
+#include "render_queue.hpp"
+#include "constant_ring.hpp"
+#include "gl_state.hpp"
+#include "instance_buffer.hpp"
+#include "load_trace.hpp"
+#include "scene_graph.hpp"
+#include "texture_cache.hpp"
+#include "thread_pool.hpp"
+
+struct ModelLoadOptions {
+    // reuse <path>.meshcache on warm loads and write it after an Assimp import
+    bool useMeshCache = true;
+    // convert meshes on defaultThreadPool(), GL uploads stay on the calling thread
+    bool parallel = true;
+    // decode textures in the background and draw with a placeholder until
+    // textureLoader().update() has uploaded them
+    bool asyncTextures = true;
+    // block compress textures (BC1/BC3) where the context supports S3TC, the result is cached
+    // next to every image (cf. TextureLoader)
+    bool compressTextures = false;
+    // keep every texture's mip chain in <image>.texcache so that warm loads skip decoding
+    // and filtering (compressed textures are always cached)
+    bool cacheTextures = true;
+    // flip images vertically on load, for models whose texture coordinates expect it
+    bool flipTextures = false;
+    // pack the model's textures that agree in size and format into GL_TEXTURE_2D_ARRAY layers
+    // once all meshes are in, meshes then select a layer instead of binding their own texture;
+    // needs a fragment shader like shader_array.fs, textures are loaded synchronously and,
+    // for streaming loads, only bound once the last mesh is in
+    bool textureArrays = false;
+    // concatenate meshes with the same textures into one buffer each and draw every
+    // such group with a single glMultiDrawElementsBaseVertex
+    bool mergeMeshes = false;
+    // reorder indices and vertices for the post-transform cache, overdraw and vertex fetch,
+    // the result is what ends up in the mesh cache
+    bool optimizeMeshes = false;
+    // upload PackedVertex (16 instead of 32 bytes) and 16 bit indices where they fit,
+    // needs a vertex shader that dequantizes like shader.vs
+    bool quantizeVertices = false;
+    // simplify every mesh into a chain of coarser index ranges (stored in the mesh cache too),
+    // draw(shader, view) then picks a level per mesh; not supported together with mergeMeshes
+    bool generateLods = false;
+    // split every mesh into meshlets of up to 126 triangles (stored in the mesh cache too),
+    // draw(shader, view) then skips the ones outside the frustum or facing away; not
+    // supported together with mergeMeshes
+    bool cullMeshlets = false;
+    // return from the constructor right away and import, convert and upload in the background,
+    // call Model::update() once per frame until it returns 0; ignored with mergeMeshes
+    bool streaming = false;
+    // free the meshes' CPU copies of vertices and indices once they are uploaded (and written
+    // to the mesh cache), only bounds, levels of detail and meshlets are kept
+    bool releaseCpuData = false;
+    // on contexts with glMultiDrawElementsIndirect (cf. loadGlExtensions) copy all meshes into
+    // one vertex and index buffer once they are loaded; draw(shader) and draw(shader, view) then
+    // submit every group of meshes with the same textures as one indirect draw, culling and
+    // level selection rewrite the commands in place (meshlets are not drawn individually);
+    // needs textureArrays and shaders like shader_indirect.vs/.fs, ignored without textureArrays,
+    // with mergeMeshes and with streaming
+    bool indirectDraw = false;
+};
+
+// what view dependent draws need to know about the frame, the matrices are the ones
+// the shader gets (the scene graph's node matrices go below model)
+struct DrawView {
+    glm::mat4 model;
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 cameraPosition;
+    float viewportHeight; // pixels
+    // set when GL_CULL_FACE is on with the default GL_BACK/GL_CCW, allows dropping meshlets that face away
+    bool backfaceCulling = false;
+};
+
+// everything Model::draw needs for one mesh besides its textures (cf. Model::resolveMaterials),
+// the index ranges are [firstPart, +numParts) of the part* arrays; meshes with levels of
+// detail have them in [firstLod, +numLods) of the lod* arrays, level 0 equals the single part,
+// and the meshlets of level 0 are drawMeshlets[firstMeshlet, +numMeshlets)
+struct DrawRecord {
+    unsigned int vao;
+    GLenum indexType;
+    glm::vec3 posOffset; // dequantization, only used for quantized models
+    glm::vec3 posScale;
+    unsigned int firstPart;
+    unsigned int numParts;
+    int node; // scene graph node, -1 for none
+    glm::vec3 center; // object space bounding sphere
+    float radius;
+    unsigned int firstLod;
+    unsigned int numLods;
+    unsigned int firstMeshlet;
+    unsigned int numMeshlets;
+};
+
+// where the time of the last load went, in milliseconds; worker times are summed over the
+// workers, so convertMs can exceed the wall time of the whole load
+struct ModelLoadStats {
+    double cacheMs = 0;   // hashing the source file and mapping the mesh cache
+    double importMs = 0;  // Assimp
+    double convertMs = 0; // processMesh and the optional optimize, meshlet and LOD steps
+    double uploadMs = 0;  // creating the meshes and texture placeholders on the GL thread
+};
 
-class Model {
+class Model : public DrawSource {
 public:
     std::vector<Texture> textures_loaded;
 
-    Model(std::string &path) {
+    Model(std::string &path, ModelLoadOptions options = ModelLoadOptions()) {
+      this->options = options;
+      dir = path.substr(0, path.find_last_of('/'));
+      if (streams()) {
+        startStreaming(path);
+        return;
+      }
       loadModel(path);
+      packTextures();
+      compileDrawList();
+      buildIndirect();
+    }
+    Model(const Model &) = delete;
+    Model &operator=(const Model &) = delete;
+    // vertex cache statistics of the last optimizing import, empty after a mesh cache hit
+    const MeshOptimizeStats &meshOptimizeStats() const { return optimizeStats; }
+    // complete once the constructor (or for streaming loads update()) is done, texture decodes
+    // and uploads are tracked by textureLoader()
+    const ModelLoadStats &loadStats() const { return timings; }
+    // the node hierarchy of the asset; change a node's local matrix to move everything
+    // below it, draw() picks the change up
+    SceneGraph &sceneGraph() { return graph; }
+    // bytes of the meshes' CPU arrays and of the draw list
+    size_t cpuBytes() const {
+      size_t total = drawList.capacity() * sizeof(DrawRecord)
+                   + partCounts.capacity() * sizeof(GLsizei) + partOffsets.capacity() * sizeof(const void *)
+                   + partBaseVertices.capacity() * sizeof(GLint) + lodCounts.capacity() * sizeof(GLsizei)
+                   + lodOffsets.capacity() * sizeof(const void *) + lodErrors.capacity() * sizeof(float)
+                   + drawMeshlets.capacity() * sizeof(Meshlet) + visibleCounts.capacity() * sizeof(GLsizei)
+                   + visibleOffsets.capacity() * sizeof(const void *) + queued.capacity() * sizeof(QueuedDraw)
+                   + queuedCounts.capacity() * sizeof(GLsizei) + queuedOffsets.capacity() * sizeof(const void *);
+      if (indirect)
+        total += indirect->commands.capacity() * sizeof(DrawElementsIndirectCommand)
+               + indirect->drawData.capacity() * sizeof(IndirectDrawData)
+               + indirect->records.capacity() * sizeof(IndirectRecord) + indirect->groups.capacity() * sizeof(IndirectGroup);
+      for (const Mesh &mesh : meshes) total += mesh.cpuBytes();
+      for (const auto &resolved : materials) total += resolved.second.capacity() * sizeof(Material);
+      return total;
+    }
+    // bytes of the meshes' buffers and of the textures, textures shared with other models
+    // are counted for each of them
+    size_t gpuBytes() const {
+      size_t total = 0;
+      for (const Mesh &mesh : meshes) total += mesh.gpuBytes();
+      for (const Texture &texture : textures_loaded)
+        if (texture.layer < 0) total += textureLoader().gpuBytes(texture.id);
+      for (unsigned int id : textureArrays) total += textureLoader().gpuBytes(id);
+      if (indirect) total += indirect->bytes;
+      return total;
+    }
+    ~Model() {
+      // workers may still read the importer's scene or the meshes' arrays
+      if (stream) {
+        if (stream->import.valid()) stream->import.wait();
+        for (std::future<MeshData> &result : stream->converted)
+          if (result.valid() && result.wait_for(std::chrono::seconds(0)) != std::future_status::deferred) result.wait();
+      }
+      if (cacheWrite.valid()) cacheWrite.wait();
+      if (indirect) {
+        for (const IndirectBatch &batch : indirect->batches) {
+          glDeleteVertexArrays(1, &batch.vao);
+          glState().vertexArrayDeleted(batch.vao);
+          const unsigned int buffers[] = { batch.vertexBuffer, batch.indexBuffer };
+          glDeleteBuffers(2, buffers);
+        }
+        const unsigned int buffers[] = { indirect->commandBuffer, indirect->drawBuffer };
+        glDeleteBuffers(2, buffers);
+      }
+      for (const Texture &texture : textures_loaded)
+        if (texture.layer < 0) textureCache().release(texture.id);
+      for (unsigned int id : textureArrays) {
+        textureLoader().forget(id);
+        glDeleteTextures(1, &id);
+        glState().textureDeleted(id);
+      }
     }
+    // streaming loads only: adds the meshes that finished converting to the model until
+    // budgetMs is spent, returns how many are still to come (0 once the model is complete);
+    // call it once per frame on the GL thread, the model draws whatever it has so far
+    size_t update(float budgetMs = 2.0f) {
+      if (!stream) return 0;
+      const auto start = std::chrono::steady_clock::now();
+      if (stream->import.valid()) {
+        // the number of meshes is unknown until the import is done
+        if (stream->import.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return 1;
+        stream->importer = stream->import.get();
+        timings.importMs = stream->importMs;
+        const aiScene *scene = stream->importer->GetScene();
+        checkScene(scene, *stream->importer);
+        std::vector<const aiMesh *> order;
+        std::vector<int> nodes;
+        processNode(scene->mRootNode, scene, order, nodes);
+        stream->converted = convertMeshes(order, nodes, scene);
+        meshes.reserve(order.size());
+      }
+
+      const size_t total = stream->importer ? stream->converted.size() : stream->cache.entries.size();
+      for (size_t added = 0; stream->next < total; added++) {
+        const float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (added > 0 && elapsedMs > budgetMs) break;
+        if (stream->importer) {
+          std::future<MeshData> &result = stream->converted[stream->next];
+          // deferred conversions (parallel off) run right here as part of the budget
+          if (result.wait_for(std::chrono::seconds(0)) == std::future_status::timeout) break;
+          addMesh(result.get());
+        } else {
+          addCached(stream->cache.entries[stream->next]);
+        }
+        compileDrawRecord(meshes.back());
+        stream->next++;
+      }
+      if (stream->next < total) return total - stream->next;
+      finishStreaming();
+      return 0;
+    }
+    // true if draw() submits through glMultiDrawElementsIndirect (cf. ModelLoadOptions::indirectDraw)
+    bool drawsIndirect() const { return indirect != nullptr; }
+    // walks the draw list compiled at load time, allocates nothing
     void draw(Shader &shader) {
-      for (auto mesh : meshes) {
-        mesh.draw(shader);
+      submit(shader, nullptr, 0.0f);
+    }
+    // like draw(shader), but meshes outside the frustum are skipped, every mesh with levels
+    // of detail is drawn with the coarsest one whose error projects to at most maxPixelError
+    // pixels and full detail meshes with meshlets only draw the ones that survive culling
+    void draw(Shader &shader, const DrawView &view, float maxPixelError = 1.0f) {
+      submit(shader, &view, maxPixelError);
+    }
+    // culls and selects levels like draw(shader, view, maxPixelError), but queues what is left
+    // as opaque items keyed by material, VAO and distance instead of drawing it; flush the
+    // queue before the model enqueues, draws or update()s again. With constants, every item's
+    // DrawConstants go into the ring and the shader has to read them like shader_ring.vs,
+    // otherwise they are set as uniforms when the item is drawn.
+    void enqueue(RenderQueue &queue, Shader &shader, const DrawView &view, float maxPixelError = 1.0f,
+        ConstantRing *constants = nullptr) {
+      queued.clear();
+      queuedCounts.clear();
+      queuedOffsets.clear();
+      queuedConstants = constants;
+      const std::vector<Material> &recordMaterials = resolveMaterials(shader);
+      forVisible(&view, maxPixelError, [&](size_t r, unsigned int lod, GLsizei numRanges, const glm::mat4 &model) {
+        const DrawRecord &record = drawList[r];
+        const glm::vec3 center = glm::vec3(model * glm::vec4(record.center, 1.0f));
+        queue.add({ 0, &shader, &recordMaterials[r], record.vao, this, (uint32_t)queued.size() },
+                  glm::length(center - view.cameraPosition));
+        GLintptr offset = -1;
+        if (constants) {
+          const float quantized = options.quantizeVertices ? 1.0f : 0.0f;
+          offset = constants->write(DrawConstants{ model, glm::vec4(record.posOffset, quantized),
+                                                   glm::vec4(record.posScale, 0.0f) });
+        }
+        queued.push_back({ (unsigned int)r, lod, (unsigned int)queuedCounts.size(), numRanges, offset });
+        queuedCounts.insert(queuedCounts.end(), visibleCounts.begin(), visibleCounts.begin() + numRanges);
+        queuedOffsets.insert(queuedOffsets.end(), visibleOffsets.begin(), visibleOffsets.begin() + numRanges);
+      });
+    }
+    // draws the whole model count times with one instanced call per mesh part, instance i
+    // placed by instances[i] between the model uniform and the scene graph nodes (the shader
+    // reads it from the instance attribute while the instanced uniform is set); full detail,
+    // no culling
+    void drawInstanced(Shader &shader, const glm::mat4 *instances, size_t count) {
+      if (count == 0) return;
+      instanceBuffer.upload(instances, count);
+      // streaming loads keep adding records
+      for (; numInstanceVaos < drawList.size(); numInstanceVaos++) instanceBuffer.attach(drawList[numInstanceVaos].vao);
+      static const glm::mat4 identity(1.0f);
+      const bool quantized = options.quantizeVertices;
+      graph.update();
+      int currentNode = -2;
+      const std::vector<Material> &recordMaterials = resolveMaterials(shader);
+      shader.setBool("instanced", true);
+      if (quantized) shader.setBool("quantized", true);
+      for (size_t r = 0; r < drawList.size(); r++) {
+        const DrawRecord &record = drawList[r];
+        if (record.node != currentNode) {
+          currentNode = record.node;
+          shader.setMat4("node", record.node >= 0 ? graph.world(record.node) : identity);
+        }
+        bindRecord(shader, record, recordMaterials[r], quantized);
+        for (unsigned int p = record.firstPart; p < record.firstPart + record.numParts; p++)
+          glDrawElementsInstancedBaseVertex(GL_TRIANGLES, partCounts[p], record.indexType, partOffsets[p], count,
+              partBaseVertices[p]);
       }
+      if (quantized) shader.setBool("quantized", false);
+      shader.setBool("instanced", false);
+    }
+    void drawInstanced(Shader &shader, const std::vector<glm::mat4> &instances) {
+      drawInstanced(shader, instances.data(), instances.size());
     }
 
 private:
     std::vector<Mesh> meshes;
+    std::vector<DrawRecord> drawList;
+    // per shader program, the textures of drawList[i] resolved as element i
+    std::unordered_map<unsigned int, std::vector<Material>> materials;
+    std::vector<GLsizei> partCounts;
+    std::vector<const void *> partOffsets;
+    std::vector<GLint> partBaseVertices;
+    std::vector<GLsizei> lodCounts;
+    std::vector<const void *> lodOffsets;
+    std::vector<float> lodErrors;
+    std::vector<Meshlet> drawMeshlets;
+    std::vector<GLsizei> visibleCounts; // scratch for cullMeshlets, sized for the largest mesh
+    std::vector<const void *> visibleOffsets;
+    // what enqueue() left for drawQueued(), the meshlet ranges of queued[i] are
+    // queuedCounts/queuedOffsets[firstRange, +numRanges)
+    struct QueuedDraw {
+      unsigned int record;
+      unsigned int lod;
+      unsigned int firstRange;
+      GLsizei numRanges;
+      GLintptr constants; // offset of its DrawConstants in queuedConstants, -1 for uniforms
+    };
+    std::vector<QueuedDraw> queued;
+    ConstantRing *queuedConstants = nullptr;
+    std::vector<GLsizei> queuedCounts;
+    std::vector<const void *> queuedOffsets;
+    std::vector<unsigned int> textureArrays; // owned by the model, unlike the cached textures
+    InstanceBuffer instanceBuffer;
+    size_t numInstanceVaos = 0; // drawList records whose VAO reads instanceBuffer
+    std::unordered_map<std::string, size_t> textureIndex; // path -> textures_loaded index
     std::string dir;
+    ModelLoadOptions options;
+    MeshOptimizeStats optimizeStats;
+    std::vector<MeshOptimizeStats> perMeshStats;
+    std::vector<double> perMeshConvertMs;
+    ModelLoadStats timings;
+    SceneGraph graph;
+
+    // what a streaming load still has to add, reset once the last mesh is in
+    struct Stream {
+      std::string path;
+      uint64_t cacheKey = 0;
+      MeshCache cache; // warm loads upload straight from its entries
+      std::future<std::unique_ptr<Assimp::Importer>> import;
+      std::unique_ptr<Assimp::Importer> importer; // owns the scene the conversions read
+      std::vector<std::future<MeshData>> converted;
+      size_t next = 0; // next mesh to add, in draw order
+      double importMs = 0;
+    };
+    std::unique_ptr<Stream> stream;
+
+    // the meshes copied together for ModelLoadOptions::indirectDraw, one batch per index type
+    struct IndirectBatch {
+      unsigned int vao;
+      unsigned int vertexBuffer;
+      unsigned int indexBuffer;
+      GLenum indexType;
+    };
+    // commands [firstCommand, +numCommands) share their batch and the textures of firstRecord
+    struct IndirectGroup {
+      unsigned int batch;
+      unsigned int firstCommand;
+      unsigned int numCommands;
+      unsigned int firstRecord;
+    };
+    // where drawList[i]'s command is and where its indices and vertices start in its batch
+    struct IndirectRecord {
+      unsigned int command;
+      GLuint firstIndex;
+      GLint baseVertex;
+    };
+    // per draw attributes, drawList[i] reads element i through its baseInstance (cf. shader_indirect.vs)
+    struct IndirectDrawData {
+      glm::mat4 node;
+      glm::vec4 posOffset; // w is the array layer of the mesh's textures, 0 without arrays
+      glm::vec4 posScale;  // w is 1 for quantized meshes
+    };
+    struct Indirect {
+      std::vector<IndirectBatch> batches;
+      std::vector<IndirectGroup> groups;
+      std::vector<IndirectRecord> records;
+      std::vector<DrawElementsIndirectCommand> commands; // by group
+      std::vector<IndirectDrawData> drawData; // by record
+      unsigned int commandBuffer = 0;
+      unsigned int drawBuffer = 0;
+      size_t bytes = 0;
+    };
+    std::unique_ptr<Indirect> indirect;
+    std::future<void> cacheWrite;
+
+    // joined vertices give the optimizers and the meshlet builder the connectivity they work on
+    static constexpr unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices;
+
+    void submit(Shader &shader, const DrawView *view, float maxPixelError) {
+      if (indirect) {
+        submitIndirect(shader, view, maxPixelError);
+        return;
+      }
+      const bool quantized = options.quantizeVertices;
+      int currentNode = -2;
+      const std::vector<Material> &recordMaterials = resolveMaterials(shader);
+      if (quantized) shader.setBool("quantized", true);
+      forVisible(view, maxPixelError, [&](size_t r, unsigned int lod, GLsizei numRanges, const glm::mat4 &) {
+        const DrawRecord &record = drawList[r];
+        // records of the same node follow each other
+        if (record.node != currentNode) {
+          currentNode = record.node;
+          shader.setMat4("node", nodeMatrix(record.node));
+        }
+        bindRecord(shader, record, recordMaterials[r], quantized);
+        issueDraw(record, lod, visibleCounts.data(), visibleOffsets.data(), numRanges);
+      });
+      if (quantized) shader.setBool("quantized", false);
+    }
+    // calls visit(r, lod, numRanges, model) for every drawList[r] that survives culling against
+    // view (all of them without a view), with the level to draw and the number of meshlet ranges
+    // in visibleCounts/visibleOffsets (0 draws the level or the parts, always without
+    // byMeshlet); model is view->model times the record's node
+    template <typename Visit>
+    void forVisible(const DrawView *view, float maxPixelError, Visit visit, bool byMeshlet = true) {
+      static const glm::mat4 identity(1.0f);
+      graph.update();
+      // per node: the largest axis scale of model * node bounds how much it grows errors and
+      // radii, culling happens in object space so that the records' bounds stay as they are
+      glm::mat4 model(1.0f);
+      float scale = 0.0f;
+      Frustum frustum(identity);
+      glm::vec3 eye(0.0f);
+      int currentNode = -2;
+      for (size_t r = 0; r < drawList.size(); r++) {
+        const DrawRecord &record = drawList[r];
+        if (view && record.node != currentNode) {
+          currentNode = record.node;
+          model = view->model * nodeMatrix(record.node);
+          scale = std::max({ glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])),
+                             glm::length(glm::vec3(model[2])) });
+          frustum = Frustum(view->projection * view->view * model);
+          eye = glm::vec3(glm::inverse(model) * glm::vec4(view->cameraPosition, 1.0f));
+        }
+        unsigned int lod = 0;
+        GLsizei numRanges = 0;
+        if (view) {
+          if (!frustum.intersects(record.center, record.radius)) continue;
+          if (record.numLods > 1) lod = selectLod(record, *view, model, scale, maxPixelError);
+          if (byMeshlet && lod == 0 && record.numMeshlets > 0) {
+            numRanges = cullMeshlets(record, frustum, eye, view->backfaceCulling);
+            if (numRanges == 0) continue;
+          }
+        }
+        visit(r, lod, numRanges, model);
+      }
+    }
+    const glm::mat4 &nodeMatrix(int node) const {
+      static const glm::mat4 identity(1.0f);
+      return node >= 0 ? graph.world(node) : identity;
+    }
+    // the draw call(s) of record at level lod, or of the numRanges meshlet ranges if there are any
+    void issueDraw(const DrawRecord &record, unsigned int lod, const GLsizei *counts, const void *const *offsets,
+        GLsizei numRanges) {
+      if (numRanges > 0) {
+        glMultiDrawElements(GL_TRIANGLES, counts, record.indexType, offsets, numRanges);
+        return;
+      }
+      if (lod > 0) {
+        glDrawElements(GL_TRIANGLES, lodCounts[record.firstLod + lod], record.indexType, lodOffsets[record.firstLod + lod]);
+        return;
+      }
+      const unsigned int p = record.firstPart;
+      if (record.numParts == 1) {
+        glDrawElementsBaseVertex(GL_TRIANGLES, partCounts[p], record.indexType, partOffsets[p], partBaseVertices[p]);
+      } else {
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, &partCounts[p], record.indexType, &partOffsets[p],
+            record.numParts, &partBaseVertices[p]);
+      }
+    }
+    // program, material and VAO are bound by the queue
+    void drawQueued(Shader &shader, uint32_t data) override {
+      const QueuedDraw &draw = queued[data];
+      const DrawRecord &record = drawList[draw.record];
+      if (draw.constants >= 0) {
+        queuedConstants->bind(ConstantRing::DRAW_BINDING, draw.constants, sizeof(DrawConstants));
+      } else {
+        shader.setMat4("node", nodeMatrix(record.node));
+        // other models may share the shader and draw in between
+        shader.setBool("quantized", options.quantizeVertices);
+        if (options.quantizeVertices) {
+          shader.setVec3("posOffset", record.posOffset);
+          shader.setVec3("posScale", record.posScale);
+        }
+      }
+      issueDraw(record, draw.lod, queuedCounts.data() + draw.firstRange, queuedOffsets.data() + draw.firstRange,
+          draw.numRanges);
+    }
+    // culling and level selection only rewrite count, firstIndex and instanceCount of the
+    // commands, which go up in one glBufferSubData together with the node matrices
+    void submitIndirect(Shader &shader, const DrawView *view, float maxPixelError) {
+      Indirect &ind = *indirect;
+      const std::vector<Material> &recordMaterials = resolveMaterials(shader);
+      for (DrawElementsIndirectCommand &command : ind.commands) command.instanceCount = 0;
+      forVisible(view, maxPixelError, [&](size_t r, unsigned int lod, GLsizei, const glm::mat4 &) {
+        const DrawRecord &record = drawList[r];
+        const IndirectRecord &base = ind.records[r];
+        DrawElementsIndirectCommand &command = ind.commands[base.command];
+        const size_t indexSize = record.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+        const unsigned int l = record.firstLod + lod;
+        const unsigned int p = record.firstPart;
+        command.count = lod > 0 ? lodCounts[l] : partCounts[p];
+        command.firstIndex = base.firstIndex + (GLuint)((uintptr_t)(lod > 0 ? lodOffsets[l] : partOffsets[p]) / indexSize);
+        command.instanceCount = 1;
+      }, false);
+      for (size_t r = 0; r < drawList.size(); r++) ind.drawData[r].node = nodeMatrix(drawList[r].node);
+      glBindBuffer(GL_ARRAY_BUFFER, ind.drawBuffer);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, ind.drawData.size() * sizeof(IndirectDrawData), ind.drawData.data());
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ind.commandBuffer);
+      glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, ind.commands.size() * sizeof(DrawElementsIndirectCommand),
+          ind.commands.data());
+      for (const IndirectGroup &group : ind.groups) {
+        bool visible = false;
+        for (unsigned int c = group.firstCommand; c < group.firstCommand + group.numCommands && !visible; c++)
+          visible = ind.commands[c].instanceCount > 0;
+        if (!visible) continue;
+        const IndirectBatch &batch = ind.batches[group.batch];
+        recordMaterials[group.firstRecord].bind();
+        glState().bindVertexArray(batch.vao);
+        glExt().multiDrawElementsIndirect(GL_TRIANGLES, batch.indexType,
+            (const void *)(group.firstCommand * sizeof(DrawElementsIndirectCommand)), group.numCommands, 0);
+      }
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    // the materials of all records for shader, resolved the first time the model is drawn with it
+    const std::vector<Material> &resolveMaterials(const Shader &shader) {
+      std::vector<Material> &resolved = materials[shader.ID];
+      // streaming loads keep adding records
+      for (size_t i = resolved.size(); i < drawList.size(); i++) resolved.emplace_back(shader, meshes[i].textures);
+      return resolved;
+    }
+    // textures, dequantization and VAO of record, glState() skips what is bound already
+    // (e.g. the array of the previous record)
+    void bindRecord(Shader &shader, const DrawRecord &record, const Material &material, bool quantized) {
+      material.bind();
+      if (quantized) {
+        shader.setVec3("posOffset", record.posOffset);
+        shader.setVec3("posScale", record.posScale);
+      }
+      glState().bindVertexArray(record.vao);
+    }
+    // index of the coarsest level of record that is still accurate enough from view
+    unsigned int selectLod(const DrawRecord &record, const DrawView &view, const glm::mat4 &model, float scale,
+        float maxPixelError) const {
+      const glm::vec3 center = glm::vec3(model * glm::vec4(record.center, 1.0f));
+      // distance to the nearest point of the bounding sphere, inside it only full detail will do
+      const float distance = glm::length(center - view.cameraPosition) - record.radius * scale;
+      if (distance <= 0.0f) return 0;
+      // pixels that one world unit covers at that distance, projection[1][1] is cot(fovy / 2)
+      const float pixelsPerUnit = 0.5f * view.viewportHeight * view.projection[1][1] / distance;
+      unsigned int lod = 0;
+      while (lod + 1 < record.numLods && lodErrors[record.firstLod + lod + 1] * scale * pixelsPerUnit <= maxPixelError)
+        lod++;
+      return lod;
+    }
+    // fills visibleCounts/visibleOffsets with the index ranges of the meshlets of record that
+    // survive culling, meshlets that follow each other in the index buffer share a range
+    GLsizei cullMeshlets(const DrawRecord &record, const Frustum &frustum, const glm::vec3 &eye, bool backfaceCulling) {
+      const size_t indexSize = record.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+      GLsizei numRanges = 0;
+      uint32_t rangeEnd = 0;
+      for (unsigned int i = record.firstMeshlet; i < record.firstMeshlet + record.numMeshlets; i++) {
+        const Meshlet &meshlet = drawMeshlets[i];
+        if (!frustum.intersects(meshlet.center, meshlet.radius)) continue;
+        if (backfaceCulling && meshletBackfacing(meshlet, eye)) continue;
+        if (numRanges > 0 && meshlet.firstIndex == rangeEnd) {
+          visibleCounts[numRanges - 1] += meshlet.numIndices;
+        } else {
+          visibleCounts[numRanges] = meshlet.numIndices;
+          visibleOffsets[numRanges] = (const void *)(meshlet.firstIndex * indexSize);
+          numRanges++;
+        }
+        rangeEnd = meshlet.firstIndex + meshlet.numIndices;
+      }
+      return numRanges;
+    }
 
     void loadModel(std::string &path) {
+      TraceSpan span("model", "load", path);
+      uint64_t cacheKey = 0;
+      if (options.useMeshCache) {
+        const auto start = std::chrono::steady_clock::now();
+        cacheKey = meshCacheKey(path);
+        if (loadFromCache(MeshCache::cachePath(path), cacheKey)) {
+          // uploads are part of it, addCached keeps track of them separately
+          timings.cacheMs = millisecondsSince(start) - timings.uploadMs;
+          return;
+        }
+        timings.cacheMs = millisecondsSince(start);
+      }
+
       Assimp::Importer importer;
       // TODO Use a smart pointer here
-      const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+      const auto start = std::chrono::steady_clock::now();
+      const aiScene *scene;
+      {
+        TraceSpan importSpan("model", "import", path);
+        scene = importer.ReadFile(path, IMPORT_FLAGS);
+      }
+      timings.importMs = millisecondsSince(start);
+      checkScene(scene, importer);
+
+      std::vector<const aiMesh *> order;
+      std::vector<int> nodes;
+      processNode(scene->mRootNode, scene, order, nodes);
 
+      std::vector<MeshView> views;
+      if (options.mergeMeshes) {
+        // merging needs every mesh at once, so there is no overlap with the uploads here
+        std::vector<MeshData> converted;
+        converted.reserve(order.size());
+        for (std::future<MeshData> &result : convertMeshes(order, nodes, scene)) converted.push_back(result.get());
+        for (const MeshData &data : converted) views.push_back(data.view());
+        addMerged(views);
+      } else {
+        processMeshes(order, nodes, scene);
+        for (const Mesh &mesh : meshes) views.push_back(mesh.view());
+      }
+
+      collectWorkerStats();
+      if (cacheKey != 0) writeMeshCache(path, cacheKey, views, graph);
+      if (options.releaseCpuData)
+        for (Mesh &mesh : meshes) mesh.releaseCpuData();
+    }
+    void startStreaming(const std::string &path) {
+      stream = std::make_unique<Stream>();
+      stream->path = path;
+      if (options.useMeshCache) {
+        const auto start = std::chrono::steady_clock::now();
+        stream->cacheKey = meshCacheKey(path);
+        TraceSpan span("cache", "open", path);
+        const bool hit = stream->cache.open(MeshCache::cachePath(path), stream->cacheKey);
+        timings.cacheMs = millisecondsSince(start);
+        if (hit) {
+          graph = std::move(stream->cache.graph);
+          meshes.reserve(stream->cache.entries.size());
+          return;
+        }
+      }
+      // the stream outlives the task, the destructor waits for it
+      double *importMs = &stream->importMs;
+      stream->import = defaultThreadPool().submit([path, importMs]() {
+        TraceSpan span("model", "import", path);
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<Assimp::Importer> importer = std::make_unique<Assimp::Importer>();
+        importer->ReadFile(path, IMPORT_FLAGS);
+        *importMs = millisecondsSince(start);
+        return importer;
+      });
+    }
+    void finishStreaming() {
+      packTextures();
+      if (stream->importer) {
+        collectWorkerStats();
+        std::vector<MeshData> released;
+        if (options.releaseCpuData)
+          for (Mesh &mesh : meshes) released.push_back(mesh.releaseCpuData());
+        if (stream->cacheKey != 0) {
+          // the views point either into the released arrays, which the task takes along, or into
+          // the meshes, which stay put until the destructor waits for the task
+          std::vector<MeshView> views;
+          if (options.releaseCpuData) {
+            for (const MeshData &data : released) views.push_back(data.view());
+          } else {
+            for (const Mesh &mesh : meshes) views.push_back(mesh.view());
+          }
+          const std::string path = stream->path;
+          const uint64_t key = stream->cacheKey;
+          // a copy, local matrices may change while the task runs
+          const SceneGraph nodes = graph;
+          cacheWrite = defaultThreadPool().submit([path, key, views, nodes, released = std::move(released)]() {
+            writeMeshCache(path, key, views, nodes);
+          });
+        }
+      }
+      stream.reset();
+    }
+    uint64_t meshCacheKey(const std::string &path) const {
+      uint32_t pipeline = 0;
+      if (options.optimizeMeshes) pipeline |= MeshCache::OPTIMIZED;
+      if (buildsLods()) pipeline |= MeshCache::LODS;
+      if (buildsMeshlets()) pipeline |= MeshCache::MESHLETS;
+      return MeshCache::makeKey(path, IMPORT_FLAGS, pipeline);
+    }
+    static void writeMeshCache(const std::string &path, uint64_t key, const std::vector<MeshView> &views,
+        const SceneGraph &nodes) {
+      TraceSpan span("cache", "write", path);
+      if (!MeshCache::write(MeshCache::cachePath(path), key, views, nodes))
+        std::cout << "failed to write mesh cache " << MeshCache::cachePath(path) << std::endl;
+    }
+    static void checkScene(const aiScene *scene, Assimp::Importer &importer) {
       if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
         std::exit(EXIT_FAILURE);
       }
-      std::cout << path << std::endl;
-      dir = path.substr(0, path.find_last_of('/'));
-
-      processNode(scene->mRootNode, scene);
     }
-    void processNode(aiNode *node, const aiScene *scene, unsigned int lvl = 0) {
-      std::string indent = std::string(lvl+1, ' ');
+    void collectWorkerStats() {
+      for (const MeshOptimizeStats &stats : perMeshStats) optimizeStats += stats;
+      perMeshStats.clear();
+      for (double ms : perMeshConvertMs) timings.convertMs += ms;
+      perMeshConvertMs.clear();
+      if (options.optimizeMeshes && loadTrace().verbose) {
+        std::cout << "vertex cache: ACMR " << optimizeStats.before.acmr() << " -> " << optimizeStats.after.acmr()
+                  << ", ATVR " << optimizeStats.before.atvr() << " -> " << optimizeStats.after.atvr() << std::endl;
+      }
+    }
+    bool loadFromCache(const std::string &cacheFile, uint64_t key) {
+      // the mapping only has to outlive the uploads below
+      MeshCache cache;
+      {
+        TraceSpan span("cache", "open", cacheFile);
+        if (!cache.open(cacheFile, key)) return false;
+      }
+      graph = std::move(cache.graph);
+      if (options.mergeMeshes) {
+        addMerged(cache.entries);
+        return true;
+      }
+      meshes.reserve(cache.entries.size());
+      for (const MeshView &entry : cache.entries) addCached(entry);
+      return true;
+    }
+    void addCached(const MeshView &entry) {
+      TraceSpan span("mesh", "upload");
+      const auto start = std::chrono::steady_clock::now();
+      meshes.emplace_back(entry.vertices, entry.numVertices, entry.indices, entry.numIndices,
+            loadTextures(entry.textures), options.quantizeVertices);
+      meshes.back().setLods(std::vector<LodLevel>(entry.lods, entry.lods + entry.numLods));
+      meshes.back().meshlets.assign(entry.meshlets, entry.meshlets + entry.numMeshlets);
+      meshes.back().node = entry.node;
+      timings.uploadMs += millisecondsSince(start);
+    }
+    // flattens meshes into drawList, the only thing draw() looks at
+    void compileDrawList() {
+      drawList.reserve(meshes.size());
+      for (const Mesh &mesh : meshes) compileDrawRecord(mesh);
+    }
+    void compileDrawRecord(const Mesh &mesh) {
+      DrawRecord record;
+      record.node = mesh.node;
+      record.vao = mesh.vao();
+      record.indexType = mesh.indexFormat();
+      record.posOffset = mesh.positionOffset();
+      record.posScale = mesh.positionScale();
+      record.firstPart = partCounts.size();
+      for (const SubMesh &part : mesh.parts) {
+        partCounts.push_back(part.numIndices);
+        partOffsets.push_back((const void *)(part.firstIndex * mesh.indexSize()));
+        partBaseVertices.push_back(part.baseVertex);
+      }
+      record.numParts = mesh.parts.size();
+      record.center = 0.5f * (mesh.boundsMin + mesh.boundsMax);
+      record.radius = 0.5f * glm::length(mesh.boundsMax - mesh.boundsMin);
+      record.firstLod = lodCounts.size();
+      for (const LodLevel &lod : mesh.lods) {
+        lodCounts.push_back(lod.numIndices);
+        lodOffsets.push_back((const void *)(lod.firstIndex * mesh.indexSize()));
+        lodErrors.push_back(lod.error);
+      }
+      record.numLods = mesh.lods.size();
+      record.firstMeshlet = drawMeshlets.size();
+      drawMeshlets.insert(drawMeshlets.end(), mesh.meshlets.begin(), mesh.meshlets.end());
+      record.numMeshlets = mesh.meshlets.size();
+      if (visibleCounts.size() < mesh.meshlets.size()) {
+        visibleCounts.resize(mesh.meshlets.size());
+        visibleOffsets.resize(mesh.meshlets.size());
+      }
+      drawList.push_back(record);
+    }
+    // walks the node tree depth first, adds every node to the scene graph and records the
+    // meshes in draw order together with their node
+    void processNode(aiNode *node, const aiScene *scene, std::vector<const aiMesh *> &order, std::vector<int> &nodes,
+        int parent = -1) {
+      TraceSpan span("model", "node", node->mName.C_Str());
+      const int index = graph.addNode(parent, toGlm(node->mTransformation), node->mName.C_Str());
       for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-        std::cout << indent + "processing mesh " << i+1 << "/" << node->mNumMeshes << std::endl;
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene, lvl+1));
+        order.push_back(scene->mMeshes[node->mMeshes[i]]);
+        nodes.push_back(index);
       }
-      for (unsigned int i = 0; i < node->mNumChildren; i++) {
-        std::cout << indent + "processing child " << i+1 << "/" << node->mNumChildren << std::endl;
-        processNode(node->mChildren[i], scene, lvl+1);
+      for (unsigned int i = 0; i < node->mNumChildren; i++)
+        processNode(node->mChildren[i], scene, order, nodes, index);
+    }
+    // aiMatrix4x4 is row major
+    static glm::mat4 toGlm(const aiMatrix4x4 &m) {
+      return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1), glm::vec4(m.a2, m.b2, m.c2, m.d2),
+                       glm::vec4(m.a3, m.b3, m.c3, m.d3), glm::vec4(m.a4, m.b4, m.c4, m.d4));
+    }
+    // queues the conversion of every mesh on the worker pool, or defers it to get() when
+    // loading serially
+    std::vector<std::future<MeshData>> convertMeshes(const std::vector<const aiMesh *> &order, const std::vector<int> &nodes,
+        const aiScene *scene) {
+      std::vector<std::future<MeshData>> pending;
+      pending.reserve(order.size());
+      // every task owns one slot, they are summed up once all meshes are in
+      perMeshStats.assign(order.size(), MeshOptimizeStats());
+      perMeshConvertMs.assign(order.size(), 0.0);
+      const bool lods = buildsLods();
+      const bool meshlets = buildsMeshlets();
+      const bool optimize = options.optimizeMeshes;
+      for (size_t i = 0; i < order.size(); i++) {
+        const aiMesh *mesh = order[i];
+        MeshOptimizeStats *stats = optimize ? &perMeshStats[i] : nullptr;
+        double *convertMs = &perMeshConvertMs[i];
+        const int node = nodes[i];
+        auto task = [mesh, node, scene, stats, convertMs, lods, meshlets, optimize]() {
+          TraceSpan span("mesh", "convert", mesh->mName.C_Str());
+          const auto start = std::chrono::steady_clock::now();
+          MeshData data = processMesh(mesh, scene);
+          data.node = node;
+          if (stats) *stats = optimizeMesh(data);
+          // before the levels of detail are appended, meshlets only cover the full detail indices
+          if (meshlets) data.meshlets = buildMeshlets(data.indices, data.vertices);
+          if (lods) generateLods(data, 3, optimize);
+          *convertMs = millisecondsSince(start);
+          return data;
+        };
+        if (options.parallel)
+          pending.push_back(defaultThreadPool().submit(task));
+        else
+          pending.push_back(std::async(std::launch::deferred, task));
       }
+      return pending;
     }
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene, unsigned int lvl = 0) {
-      std::string indent = std::string(lvl+1, ' ');
-      std::vector<Vertex> vertices;
-      std::vector<unsigned int> indices;
-      std::vector<Texture> textures;
-      for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-        // std::cout << indent + "processing vertex " << i+1 << "/" << mesh->mNumVertices << std::endl;
-        Vertex vertex;
-        glm::vec3 vector;
-        vector.x = mesh->mVertices[i].x;
-        vector.y = mesh->mVertices[i].y;
-        vector.z = mesh->mVertices[i].z;
-        vertex.position = vector;
-        vector.x = mesh->mNormals[i].x;
-        vector.y = mesh->mNormals[i].y;
-        vector.z = mesh->mNormals[i].z;
-        vertex.normal = vector;
-        if (mesh->mTextureCoords[0]) {
-          glm::vec2 vec;
-          vec.x = mesh->mTextureCoords[0][i].x;
-          vec.y = mesh->mTextureCoords[0][i].y;
-          vertex.texCoord = vec;
-        } else {
-          vertex.texCoord = glm::vec2(0.0f, 0.0f);
+    // only the GL uploads run here on the context thread, in order, while later meshes
+    // are still being converted
+    void processMeshes(const std::vector<const aiMesh *> &order, const std::vector<int> &nodes, const aiScene *scene) {
+      meshes.reserve(meshes.size() + order.size());
+      for (std::future<MeshData> &result : convertMeshes(order, nodes, scene)) addMesh(result.get());
+    }
+    // concatenates meshes that use the same textures into one buffer per texture set,
+    // each former mesh becomes a SubMesh that keeps its own indices and a base vertex;
+    // node transforms are baked into the vertices, so merged meshes can not be moved
+    void addMerged(const std::vector<MeshView> &views) {
+      TraceSpan span("mesh", "merge");
+      const auto start = std::chrono::steady_clock::now();
+      graph.update();
+      std::vector<std::vector<Texture>> textures;
+      std::vector<std::vector<size_t>> groups;
+      std::unordered_map<std::string, size_t> groupIndex; // texture set -> groups index
+      for (size_t i = 0; i < views.size(); i++) {
+        textures.push_back(loadTextures(views[i].textures));
+        std::string key;
+        for (const Texture &texture : textures.back())
+          key += texture.type + ":" + texture.path + ";";
+        auto it = groupIndex.emplace(key, groups.size()).first;
+        if (it->second == groups.size()) groups.emplace_back();
+        groups[it->second].push_back(i);
+      }
+
+      meshes.reserve(meshes.size() + groups.size());
+      for (const std::vector<size_t> &group : groups) {
+        size_t numVertices = 0, numIndices = 0;
+        for (size_t i : group) {
+          numVertices += views[i].numVertices;
+          numIndices += fullDetailIndices(views[i]);
         }
-        vertices.push_back(vertex);
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        std::vector<SubMesh> parts;
+        vertices.reserve(numVertices);
+        indices.reserve(numIndices);
+        for (size_t i : group) {
+          const MeshView &view = views[i];
+          const size_t count = fullDetailIndices(view);
+          parts.push_back({ indices.size(), count, (int)vertices.size() });
+          vertices.insert(vertices.end(), view.vertices, view.vertices + view.numVertices);
+          indices.insert(indices.end(), view.indices, view.indices + count);
+          if (view.node >= 0) transformVertices(&vertices[vertices.size() - view.numVertices], view.numVertices, graph.world(view.node));
+        }
+        meshes.emplace_back(std::move(vertices), std::move(indices), std::move(textures[group[0]]), std::move(parts),
+            options.quantizeVertices);
       }
+      timings.uploadMs += millisecondsSince(start);
+    }
+    static void transformVertices(Vertex *vertices, size_t numVertices, const glm::mat4 &transform) {
+      const glm::mat4 normalTransform = glm::transpose(glm::inverse(transform));
+      for (size_t i = 0; i < numVertices; i++) {
+        vertices[i].position = glm::vec3(transform * glm::vec4(vertices[i].position, 1.0f));
+        const glm::vec3 normal = glm::vec3(normalTransform * glm::vec4(vertices[i].normal, 0.0f));
+        const float length = glm::length(normal);
+        if (length > 0.0f) vertices[i].normal = normal / length;
+      }
+    }
+    // indices of level 0, the coarser levels that may follow them are not merged
+    static size_t fullDetailIndices(const MeshView &view) {
+      return view.numLods ? view.lods[0].numIndices : view.numIndices;
+    }
+    void addMesh(MeshData &&data) {
+      TraceSpan span("mesh", "upload");
+      const auto start = std::chrono::steady_clock::now();
+      meshes.emplace_back(std::move(data.vertices), std::move(data.indices), loadTextures(data.textures),
+          std::vector<SubMesh>(), options.quantizeVertices);
+      meshes.back().setLods(std::move(data.lods));
+      meshes.back().meshlets = std::move(data.meshlets);
+      meshes.back().node = data.node;
+      timings.uploadMs += millisecondsSince(start);
+    }
+    static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    bool buildsLods() const { return options.generateLods && !options.mergeMeshes; }
+    bool buildsMeshlets() const { return options.cullMeshlets && !options.mergeMeshes; }
+    bool streams() const { return options.streaming && !options.mergeMeshes; }
+    // only reads from scene, safe to run on any thread
+    static MeshData processMesh(const aiMesh *mesh, const aiScene *scene) {
+      MeshData data;
+      data.vertices.resize(mesh->mNumVertices);
+      convertVertices(mesh, data.vertices.data());
+
+      size_t numIndices = 0;
+      for (unsigned int i = 0; i < mesh->mNumFaces; i++) numIndices += mesh->mFaces[i].mNumIndices;
+      data.indices.resize(numIndices);
+      unsigned int *index = data.indices.data();
       for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-        // std::cout << indent + "processing face " << i+1 << "/" << mesh->mNumFaces << std::endl;
-        aiFace face = mesh->mFaces[i];
-        for (unsigned int j = 0; j < face.mNumIndices; j++) {
-          indices.push_back(face.mIndices[j]);
-        }
+        const aiFace &face = mesh->mFaces[i];
+        std::memcpy(index, face.mIndices, face.mNumIndices * sizeof(unsigned int));
+        index += face.mNumIndices;
       }
+
       if (mesh->mMaterialIndex >= 0) {
-        aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-        std::vector<Texture> diffuseMaps = loadMaterialTexture(*material, aiTextureType_DIFFUSE, "texture_diffuse", lvl);
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        std::vector<Texture> specularMaps = loadMaterialTexture(*material, aiTextureType_SPECULAR, "texture_specular", lvl);
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        const aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+        materialTextures(*material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
+        materialTextures(*material, aiTextureType_SPECULAR, "texture_specular", data.textures);
       }
-      return Mesh(vertices, indices, textures);
+      return data;
     }
 
-    std::vector<Texture> loadMaterialTexture(aiMaterial &mat,
-        aiTextureType type, std::string typeName, unsigned int lvl)
+    // interleaves Assimp's position/normal/uv arrays into out[0..mNumVertices)
+    static void convertVertices(const aiMesh *mesh, Vertex *out) {
+      const unsigned int n = mesh->mNumVertices;
+      const aiVector3D *positions = mesh->mVertices;
+      const aiVector3D *normals = mesh->mNormals;
+      const aiVector3D *uvs = mesh->mTextureCoords[0];
+      unsigned int i = 0;
+#if defined(__SSE2__) && !defined(ASSIMP_DOUBLE_PRECISION)
+      // aiVector3D is three packed floats, so a vertex is assembled from three unaligned
+      // 4-float loads, each of them reaching one float into the next element; this is why
+      // the last vertex is left to the scalar loop
+      if (normals && uvs) {
+        for (; i + 1 < n; i++) {
+          const __m128 p = _mm_loadu_ps(&positions[i].x); // px py pz  -
+          const __m128 nrm = _mm_loadu_ps(&normals[i].x); // nx ny nz  -
+          const __m128 uv = _mm_loadu_ps(&uvs[i].x);      //  u  v  -  -
+          const __m128 pzNx = _mm_shuffle_ps(p, nrm, _MM_SHUFFLE(0, 0, 2, 2));
+          float *dst = (float *)&out[i];
+          _mm_store_ps(dst, _mm_shuffle_ps(p, pzNx, _MM_SHUFFLE(2, 0, 1, 0)));     // px py pz nx
+          _mm_store_ps(dst + 4, _mm_shuffle_ps(nrm, uv, _MM_SHUFFLE(1, 0, 2, 1))); // ny nz  u  v
+        }
+      }
+#endif
+      for (; i < n; i++) {
+        Vertex &vertex = out[i];
+        vertex.position = glm::vec3(positions[i].x, positions[i].y, positions[i].z);
+        vertex.normal = normals ? glm::vec3(normals[i].x, normals[i].y, normals[i].z) : glm::vec3(0.0f);
+        vertex.texCoord = uvs ? glm::vec2(uvs[i].x, uvs[i].y) : glm::vec2(0.0f, 0.0f);
+      }
+    }
+
+    static void materialTextures(const aiMaterial &mat, aiTextureType type, const std::string &typeName,
+        std::vector<TextureRef> &textures)
     {
-      std::string indent = std::string(lvl+1, ' ');
-      std::vector<Texture> textures;
       for (unsigned int i = 0; i < mat.GetTextureCount(type); i++) {
-        std::cout << indent + "loading material texture " << i+1 << "/" << mat.GetTextureCount(type) << std::endl;
         aiString str;
         mat.GetTexture(type, i, &str);
-        bool skip = false;
-        std::string path = std::string(str.C_Str());
-        for (unsigned int j = 0; j < textures_loaded.size(); j++) {
-          if (textures_loaded[j].path == path == 0) {
-            textures.push_back(textures_loaded[j]);
-            skip = true;
-            break;
-          }
-        }
-        if (skip) continue;
-        Texture texture;
-        texture.id = textureFromFile(path, dir);
-        texture.type = typeName;
-        texture.path = std::string(str.C_Str());
-        textures_loaded.push_back(texture);
+        textures.push_back({ typeName, std::string(str.C_Str()) });
       }
+    }
+
+    std::vector<Texture> loadTextures(const std::vector<TextureRef> &refs) {
+      std::vector<Texture> textures;
+      for (const TextureRef &ref : refs) textures.push_back(loadTexture(ref.path, ref.type));
       return textures;
     }
 
-    unsigned int textureFromFile(std::string &path, std::string &dir) {
-        std::string fname = dir + "/" + path;
-        unsigned int id;
-        glGenTextures(1, &id);
-        int width, height, nrComponents;
-        unsigned char *data = stbi_load(fname.c_str(), &width, &height, &nrComponents, 0);
-        if (!data) {
-            std::cout << "failed to load texture " << fname << std::endl;
-            std::exit(EXIT_FAILURE);
-        }
-        GLenum format;
-        if (nrComponents == 1)
-          format = GL_RED;
-        else if (nrComponents == 3)
-          format = GL_RGB;
-        else if (nrComponents == 4)
-          format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, id);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-
-        return id;
-    };
+    // every distinct file is acquired from textureCache() once per model
+    Texture loadTexture(const std::string &path, const std::string &typeName) {
+      auto it = textureIndex.find(path);
+      if (it != textureIndex.end()) {
+        Texture texture = textures_loaded[it->second];
+        texture.type = typeName;
+        return texture;
+      }
+      Texture texture;
+      // packTextures() fills in arrays once every texture of the model is known
+      texture.id = options.textureArrays ? 0 : textureCache().acquire(dir + "/" + path, options.asyncTextures, textureFlags(typeName));
+      texture.type = typeName;
+      texture.path = path;
+      textureIndex.emplace(path, textures_loaded.size());
+      textures_loaded.push_back(texture);
+      return texture;
+    }
+    unsigned int textureFlags(const std::string &typeName) const {
+      unsigned int flags = 0;
+      if (options.compressTextures) flags |= TextureLoader::COMPRESS;
+      if (options.cacheTextures) flags |= TextureLoader::CACHE;
+      if (options.flipTextures) flags |= TextureLoader::FLIP_VERTICALLY;
+      // diffuse maps hold colours, the rest (specular, normal, height) is filtered as data
+      if (typeName == "texture_diffuse") flags |= TextureLoader::SRGB;
+      return flags;
+    }
+    // copies the meshes' buffers into the batches on the GPU, so that meshes uploaded straight
+    // from the mesh cache or with their CPU copies released work as well; the meshes keep their
+    // own buffers for enqueue() and drawInstanced()
+    void buildIndirect() {
+      // shader_indirect.fs samples every draw's layer from one array
+      if (!options.indirectDraw || !options.textureArrays || options.mergeMeshes || options.streaming
+          || !glExt().multiDrawElementsIndirect)
+        return;
+      TraceSpan span("mesh", "indirect");
+      indirect = std::make_unique<Indirect>();
+      Indirect &ind = *indirect;
+      std::vector<size_t> vertexBytes, indexBytes; // per batch
+      std::vector<unsigned int> batchOf(meshes.size());
+      ind.records.resize(meshes.size());
+      for (size_t i = 0; i < meshes.size(); i++) {
+        const Mesh &mesh = meshes[i];
+        unsigned int b = 0;
+        while (b < ind.batches.size() && ind.batches[b].indexType != mesh.indexFormat()) b++;
+        if (b == ind.batches.size()) {
+          ind.batches.push_back({ 0, 0, 0, mesh.indexFormat() });
+          vertexBytes.push_back(0);
+          indexBytes.push_back(0);
+        }
+        batchOf[i] = b;
+        ind.records[i].baseVertex = vertexBytes[b] / mesh.vertexSize();
+        ind.records[i].firstIndex = indexBytes[b] / mesh.indexSize();
+        vertexBytes[b] += mesh.vertexCount() * mesh.vertexSize();
+        indexBytes[b] += mesh.indexCount() * mesh.indexSize();
+      }
+
+      // commands of meshes with the same textures follow each other
+      std::unordered_map<std::string, size_t> groupIndex;
+      std::vector<std::vector<unsigned int>> members;
+      for (size_t i = 0; i < meshes.size(); i++) {
+        std::string key = std::to_string(batchOf[i]);
+        for (const Texture &texture : meshes[i].textures) key += ":" + std::to_string(texture.id);
+        auto it = groupIndex.emplace(key, members.size()).first;
+        if (it->second == members.size()) members.emplace_back();
+        members[it->second].push_back(i);
+      }
+      for (const std::vector<unsigned int> &group : members) {
+        ind.groups.push_back({ batchOf[group[0]], (unsigned int)ind.commands.size(), (unsigned int)group.size(), group[0] });
+        for (unsigned int r : group) {
+          ind.records[r].command = ind.commands.size();
+          ind.commands.push_back({ (GLuint)partCounts[drawList[r].firstPart], 1, ind.records[r].firstIndex, ind.records[r].baseVertex, r });
+        }
+      }
+      for (size_t r = 0; r < drawList.size(); r++) {
+        // the first texture's, which is the diffuse one that shader_indirect.fs samples
+        float layer = 0.0f;
+        for (const Texture &texture : meshes[r].textures) {
+          if (texture.layer < 0) continue;
+          layer = texture.layer;
+          break;
+        }
+        const float quantized = options.quantizeVertices ? 1.0f : 0.0f;
+        ind.drawData.push_back({ nodeMatrix(drawList[r].node), glm::vec4(drawList[r].posOffset, layer),
+                                 glm::vec4(drawList[r].posScale, quantized) });
+      }
+
+      glGenBuffers(1, &ind.drawBuffer);
+      glBindBuffer(GL_ARRAY_BUFFER, ind.drawBuffer);
+      glBufferData(GL_ARRAY_BUFFER, ind.drawData.size() * sizeof(IndirectDrawData), ind.drawData.data(), GL_DYNAMIC_DRAW);
+      glGenBuffers(1, &ind.commandBuffer);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ind.commandBuffer);
+      glBufferData(GL_DRAW_INDIRECT_BUFFER, ind.commands.size() * sizeof(DrawElementsIndirectCommand),
+          ind.commands.data(), GL_DYNAMIC_DRAW);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+      ind.bytes = ind.drawData.size() * sizeof(IndirectDrawData) + ind.commands.size() * sizeof(DrawElementsIndirectCommand);
+
+      for (size_t b = 0; b < ind.batches.size(); b++) {
+        IndirectBatch &batch = ind.batches[b];
+        glGenVertexArrays(1, &batch.vao);
+        glGenBuffers(1, &batch.vertexBuffer);
+        glGenBuffers(1, &batch.indexBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch.vertexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertexBytes[b], nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch.indexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, indexBytes[b], nullptr, GL_STATIC_DRAW);
+        ind.bytes += vertexBytes[b] + indexBytes[b];
+
+        glState().bindVertexArray(batch.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vertexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.indexBuffer);
+        Mesh::setupAttributes(options.quantizeVertices);
+        glBindBuffer(GL_ARRAY_BUFFER, ind.drawBuffer);
+        const GLuint location = 3;
+        for (GLuint i = 0; i < 6; i++) {
+          glEnableVertexAttribArray(location + i);
+          glVertexAttribPointer(location + i, 4, GL_FLOAT, GL_FALSE, sizeof(IndirectDrawData), (void *)(i * sizeof(glm::vec4)));
+          glVertexAttribDivisor(location + i, 1);
+        }
+        glState().bindVertexArray(0);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      for (size_t i = 0; i < meshes.size(); i++) {
+        const Mesh &mesh = meshes[i];
+        const IndirectBatch &batch = ind.batches[batchOf[i]];
+        const IndirectRecord &base = ind.records[i];
+        glBindBuffer(GL_COPY_READ_BUFFER, mesh.vertexBuffer());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch.vertexBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, base.baseVertex * mesh.vertexSize(),
+            mesh.vertexCount() * mesh.vertexSize());
+        glBindBuffer(GL_COPY_READ_BUFFER, mesh.indexBuffer());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch.indexBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, base.firstIndex * mesh.indexSize(),
+            mesh.indexCount() * mesh.indexSize());
+      }
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    // textureArrays only: loads textures_loaded into arrays and points the meshes at their
+    // layers, materials resolved so far are dropped
+    void packTextures() {
+      if (!options.textureArrays || textures_loaded.empty()) return;
+      std::vector<std::string> files;
+      std::vector<unsigned int> flags;
+      for (const Texture &texture : textures_loaded) {
+        files.push_back(dir + "/" + texture.path);
+        flags.push_back(textureFlags(texture.type));
+      }
+      const std::vector<TextureLayer> layers = textureLoader().loadArrays(files, flags);
+      for (size_t i = 0; i < layers.size(); i++) {
+        textures_loaded[i].id = layers[i].id;
+        textures_loaded[i].layer = layers[i].layer;
+        if (std::find(textureArrays.begin(), textureArrays.end(), layers[i].id) == textureArrays.end())
+          textureArrays.push_back(layers[i].id);
+      }
+      for (Mesh &mesh : meshes) {
+        for (Texture &texture : mesh.textures) {
+          const Texture &loaded = textures_loaded[textureIndex.at(texture.path)];
+          texture.id = loaded.id;
+          texture.layer = loaded.layer;
+        }
+        mesh.resetMaterial();
+      }
+      materials.clear();
+    }
 };
 
 #endif
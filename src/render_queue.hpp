@@ -0,0 +1,183 @@
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+
+#include "glad/glad.h"
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "gl_state.hpp"
+#include "material.hpp"
+#include "shader.hpp"
+
+// Whoever queues DrawItems issues their draw calls, with the program, material and VAO of
+// the item already bound; data is what the item was queued with.
+class DrawSource {
+public:
+    virtual void drawQueued(Shader &shader, uint32_t data) = 0;
+
+protected:
+    ~DrawSource() = default;
+};
+
+struct DrawItem {
+    uint64_t key; // cf. RenderQueue::opaqueKey / transparentKey
+    Shader *shader;
+    const Material *material; // nullptr if the textures are bound by other means
+    unsigned int vao;
+    DrawSource *source;
+    uint32_t data;
+};
+
+// what the last flush() submitted and how often it had to switch state for that
+struct RenderQueueStats {
+    size_t items = 0;
+    size_t programChanges = 0;
+    size_t materialChanges = 0;
+    size_t vaoChanges = 0;
+};
+
+// Collects the draws of a frame and submits them sorted by a 64 bit key. Opaque draws are
+// keyed by program, material, VAO and then front to back depth, so that state changes as
+// rarely as possible and early depth testing rejects what is hidden. Transparent draws come
+// after them, back to front first for correct blending and by state among equal depths.
+// Both buckets are radix sorted separately.
+class RenderQueue {
+public:
+    enum Bucket { OPAQUE, TRANSPARENT };
+
+    // depth is the view space distance, keys only keep the low bits of program, material
+    // and VAO names, which only costs grouping when they collide
+    static uint64_t opaqueKey(unsigned int program, const Material *material, unsigned int vao, float depth)
+    {
+      return (uint64_t)(program & 0xFFF) << 52 | (uint64_t)materialBits(material) << 36 | (uint64_t)(vao & 0xFFF) << 24
+           | depthBits(depth);
+    }
+    static uint64_t transparentKey(unsigned int program, const Material *material, unsigned int vao, float depth)
+    {
+      return (uint64_t)(0xFFFFFF - depthBits(depth)) << 40 | (uint64_t)(program & 0xFFF) << 28
+           | (uint64_t)materialBits(material) << 12 | (vao & 0xFFF);
+    }
+
+    void add(Bucket bucket, const DrawItem &item)
+    {
+      buckets[bucket].push_back(item);
+    }
+    // queues item with the opaque key computed from its own fields
+    void add(const DrawItem &item, float depth)
+    {
+      DrawItem keyed = item;
+      keyed.key = opaqueKey(item.shader->ID, item.material, item.vao, depth);
+      add(OPAQUE, keyed);
+    }
+
+    size_t size() const { return buckets[OPAQUE].size() + buckets[TRANSPARENT].size(); }
+
+    // sorts and draws everything queued, then empties the queue
+    void flush()
+    {
+      stats = RenderQueueStats();
+      const Shader *shader = nullptr;
+      const Material *material = nullptr; // the last one bound
+      uint16_t materialKey = 0;
+      unsigned int vao = 0;
+      for (std::vector<DrawItem> &items : buckets) {
+        sort(items);
+        for (const DrawItem &item : items) {
+          if (item.shader != shader) {
+            shader = item.shader;
+            item.shader->use();
+            stats.programChanges++;
+            // sampler uniforms belong to the program
+            material = nullptr;
+          }
+          // every mesh owns its Material, so the key groups materials that bind the same
+          // textures rather than pointers; the full comparison rules out key collisions
+          if (item.material
+              && (!material || item.material->bindingKey() != materialKey || !item.material->bindsSameAs(*material))) {
+            material = item.material;
+            materialKey = material->bindingKey();
+            material->bind();
+            stats.materialChanges++;
+          }
+          if (item.vao != vao || stats.items == 0) {
+            vao = item.vao;
+            glState().bindVertexArray(vao);
+            stats.vaoChanges++;
+          }
+          item.source->drawQueued(*item.shader, item.data);
+          stats.items++;
+        }
+        items.clear();
+      }
+    }
+
+    const RenderQueueStats &lastStats() const { return stats; }
+
+private:
+    std::vector<DrawItem> buckets[2];
+    std::vector<DrawItem> scratch;
+    RenderQueueStats stats;
+
+    static uint32_t materialBits(const Material *material) { return material ? material->bindingKey() : 0; }
+
+    // non-negative floats order like their bit patterns, the top 24 of 31 bits are kept
+    static uint32_t depthBits(float depth)
+    {
+      if (!(depth > 0.0f)) return 0;
+      uint32_t bits;
+      std::memcpy(&bits, &depth, sizeof(bits));
+      return bits >> 7;
+    }
+
+    // least significant byte first, stable, passes over a byte that all keys share are skipped
+    void sort(std::vector<DrawItem> &items)
+    {
+      scratch.resize(items.size());
+      for (int shift = 0; shift < 64; shift += 8) {
+        size_t offsets[256] = {};
+        for (const DrawItem &item : items) offsets[(item.key >> shift) & 0xFF]++;
+        if (offsets[(items.empty() ? 0 : items[0].key >> shift) & 0xFF] == items.size()) continue;
+        size_t sum = 0;
+        for (size_t &offset : offsets) {
+          const size_t count = offset;
+          offset = sum;
+          sum += count;
+        }
+        for (const DrawItem &item : items) scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+        items.swap(scratch);
+      }
+    }
+};
+
+// Non-indexed draws that differ in their "model" matrix, e.g. the cube scenes. Clear it when
+// the queue is flushed and add the draws of the next frame.
+class ArrayDrawSource : public DrawSource {
+public:
+    // returns the data to queue the draw with
+    uint32_t add(const glm::mat4 &model, GLint first, GLsizei count)
+    {
+      draws.push_back({ model, first, count });
+      return draws.size() - 1;
+    }
+    void clear() { draws.clear(); }
+
+    void drawQueued(Shader &shader, uint32_t data) override
+    {
+      const Draw &draw = draws[data];
+      shader.setMat4("model", draw.model);
+      glDrawArrays(GL_TRIANGLES, draw.first, draw.count);
+    }
+
+private:
+    struct Draw {
+      glm::mat4 model;
+      GLint first;
+      GLsizei count;
+    };
+    std::vector<Draw> draws;
+};
+
+#endif
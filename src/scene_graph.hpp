@@ -0,0 +1,96 @@
+#ifndef SCENE_GRAPH_HPP
+#define SCENE_GRAPH_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// Transform hierarchy as parallel arrays. Nodes are stored parents first (every parent
+// index is smaller than the node's own), so update() brings all world matrices up to date
+// in a single forward pass that only touches nodes below something that changed.
+class SceneGraph {
+public:
+    std::vector<int> parents; // -1 for roots
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds; // valid after update()
+    std::vector<std::string> names;
+
+    size_t size() const { return parents.size(); }
+
+    // parent has to be -1 or an existing node, returns the new node's index
+    int addNode(int parent, const glm::mat4 &local, const std::string &name) {
+      parents.push_back(parent);
+      locals.push_back(local);
+      worlds.push_back(local);
+      names.push_back(name);
+      dirty.push_back(1);
+      firstDirty = std::min(firstDirty, parents.size() - 1);
+      return parents.size() - 1;
+    }
+
+    // first node called name, -1 if there is none
+    int find(const std::string &name) const {
+      for (size_t i = 0; i < names.size(); i++)
+        if (names[i] == name) return i;
+      return -1;
+    }
+
+    void setLocal(int node, const glm::mat4 &local) {
+      locals[node] = local;
+      dirty[node] = 1;
+      firstDirty = std::min(firstDirty, (size_t)node);
+    }
+
+    const glm::mat4 &world(int node) const { return worlds[node]; }
+
+    // recomputes the world matrices of changed nodes and everything below them
+    void update() {
+      const size_t n = parents.size();
+      if (firstDirty >= n) return;
+      for (size_t i = firstDirty; i < n; i++) {
+        const int parent = parents[i];
+        // a dirty parent was updated earlier in this pass and marks its children on the way
+        if (parent >= 0 && dirty[parent]) dirty[i] = 1;
+        if (!dirty[i]) continue;
+        if (parent < 0)
+          worlds[i] = locals[i];
+        else
+          multiply(worlds[parent], locals[i], worlds[i]);
+      }
+      std::fill(dirty.begin() + firstDirty, dirty.end(), 0);
+      firstDirty = SIZE_MAX;
+    }
+
+private:
+    std::vector<uint8_t> dirty;
+    size_t firstDirty = SIZE_MAX;
+
+    // out = a * b for column major matrices
+    static void multiply(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out) {
+#if defined(__SSE__)
+      // every column of the result is a linear combination of a's columns
+      const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+      const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+      const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+      const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+      for (int j = 0; j < 4; j++) {
+        __m128 column = _mm_mul_ps(a0, _mm_set1_ps(b[j][0]));
+        column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(b[j][1])));
+        column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(b[j][2])));
+        column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(b[j][3])));
+        _mm_storeu_ps(&out[j][0], column);
+      }
+#else
+      out = a * b;
+#endif
+    }
+};
+
+#endif
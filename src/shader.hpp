@@ -11,6 +11,8 @@
 #include <sstream>
 #include <iostream>
 
+#include "gl_state.hpp"
+
 class Shader {
   public:
     unsigned int ID; // program id
@@ -83,7 +85,7 @@ class Shader {
       glDeleteShader(fragment);
     }
 
-    void use() { glUseProgram(ID); }
+    void use() { glState().useProgram(ID); }
 
     void setBool(const std::string &name, bool value) const {
       setInt(name, (int)value);
@@ -104,6 +106,12 @@ class Shader {
     void setVec3(const std::string &name, glm::vec3 vec) const {
       glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(vec));
     }
+
+    // the uniform block name reads from binding point binding (cf. glBindBufferRange)
+    void setBlockBinding(const std::string &name, GLuint binding) const {
+      const GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+      if (index != GL_INVALID_INDEX) glUniformBlockBinding(ID, index, binding);
+    }
 };
 
 #endif
@@ -3,15 +3,38 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in mat4 aInstance; // Model::drawInstanced only
 
 out vec2 texCoord;
+out vec3 normal;
 
 uniform mat4 model;
+uniform mat4 node; // the mesh's scene graph node, below model
 uniform mat4 view;
 uniform mat4 projection;
+uniform bool instanced;
+
+// set for meshes uploaded as PackedVertex (cf. mesh.hpp): aPos is then in [0,1] relative
+// to the mesh bounds and aNormal.xy holds an octahedral encoded normal
+uniform bool quantized;
+uniform vec3 posOffset;
+uniform vec3 posScale;
+
+vec3 octDecode(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
 
 void main()
 {
+  vec3 position = quantized ? posOffset + aPos * posScale : aPos;
+  vec3 objNormal = quantized ? octDecode(aNormal.xy) : aNormal;
+  mat4 world = instanced ? model * aInstance * node : model * node;
   texCoord = aTexCoord;
-  gl_Position = projection * view * model * vec4(aPos, 1.0);
+  normal = mat3(world) * objNormal;
+  gl_Position = projection * view * world * vec4(position, 1.0);
 }
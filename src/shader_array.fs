@@ -0,0 +1,18 @@
+#version 330 core
+
+out vec4 fragColor;
+
+in vec2 texCoord;
+
+// shader.fs for models loaded with ModelLoadOptions::textureArrays, every material texture
+// is a layer of an array (cf. Model::bindRecord)
+struct Material {
+  sampler2DArray texture_diffuse1;
+  int texture_diffuse1_layer;
+};
+uniform Material material;
+
+void main()
+{
+  fragColor = texture(material.texture_diffuse1, vec3(texCoord, material.texture_diffuse1_layer));
+}
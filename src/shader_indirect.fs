@@ -0,0 +1,18 @@
+#version 330 core
+
+out vec4 fragColor;
+
+in vec2 texCoord;
+flat in int layer;
+
+// shader_array.fs with the layer coming per draw from shader_indirect.vs, the draws of one
+// glMultiDrawElementsIndirect share the array but not the layer
+struct Material {
+  sampler2DArray texture_diffuse1;
+};
+uniform Material material;
+
+void main()
+{
+  fragColor = texture(material.texture_diffuse1, vec3(texCoord, layer));
+}
@@ -0,0 +1,38 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+// per draw, selected by the command's baseInstance (cf. Model::IndirectDrawData)
+layout (location = 3) in mat4 aNode;
+layout (location = 7) in vec4 aPosOffset; // w is the texture array layer
+layout (location = 8) in vec4 aPosScale;  // w is 1 for quantized meshes
+
+out vec2 texCoord;
+out vec3 normal;
+flat out int layer;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+vec3 octDecode(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+void main()
+{
+  bool quantized = aPosScale.w > 0.0;
+  vec3 position = quantized ? aPosOffset.xyz + aPos * aPosScale.xyz : aPos;
+  vec3 objNormal = quantized ? octDecode(aNormal.xy) : aNormal;
+  mat4 world = model * aNode;
+  texCoord = aTexCoord;
+  normal = mat3(world) * objNormal;
+  layer = int(aPosOffset.w);
+  gl_Position = projection * view * world * vec4(position, 1.0);
+}
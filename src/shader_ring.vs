@@ -0,0 +1,39 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+
+out vec2 texCoord;
+out vec3 normal;
+
+// shader.vs with the matrices and the dequantization in uniform blocks, which a
+// ConstantRing binds (cf. FrameConstants / DrawConstants in constant_ring.hpp)
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+};
+layout (std140) uniform Draw {
+  mat4 world; // model * node
+  vec4 posOffset; // w is 1 for quantized meshes
+  vec4 posScale;
+};
+
+vec3 octDecode(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+void main()
+{
+  bool quantized = posOffset.w > 0.0;
+  vec3 position = quantized ? posOffset.xyz + aPos * posScale.xyz : aPos;
+  vec3 objNormal = quantized ? octDecode(aNormal.xy) : aNormal;
+  texCoord = aTexCoord;
+  normal = mat3(world) * objNormal;
+  gl_Position = projection * view * world * vec4(position, 1.0);
+}
@@ -0,0 +1,83 @@
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include "glad/glad.h"
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+#include "gl_state.hpp"
+#include "texture_loader.hpp"
+
+// Process wide, reference counted set of loaded textures keyed by canonical file path,
+// so that every model sharing a file costs one decode and one upload.
+class TextureCache {
+public:
+    TextureCache() = default;
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    // returns the texture for file, loading it on first use,
+    // every acquire has to be paired with a release of the returned id, whoever loads a file
+    // first decides its TextureLoader::Flags
+    unsigned int acquire(const std::string &file, bool async = true, unsigned int flags = 0) {
+      const std::string key = canonical(file);
+      auto it = entries.find(key);
+      if (it != entries.end()) {
+        it->second.refs++;
+        return it->second.id;
+      }
+      Entry entry;
+      entry.id = async ? textureLoader().load(file, flags) : textureLoader().loadNow(file, flags);
+      entry.refs = 1;
+      entries.emplace(key, entry);
+      keys.emplace(entry.id, key);
+      return entry.id;
+    }
+
+    // drops one reference, the texture is deleted together with the last one
+    void release(unsigned int id) {
+      auto key = keys.find(id);
+      if (key == keys.end()) return;
+      auto it = entries.find(key->second);
+      if (--it->second.refs > 0) return;
+      textureLoader().forget(id);
+      glDeleteTextures(1, &id);
+      glState().textureDeleted(id);
+      entries.erase(it);
+      keys.erase(key);
+    }
+
+    size_t size() const { return entries.size(); }
+
+    // bytes of all cached textures as uploaded, including their mip chains
+    size_t gpuBytes() const {
+      size_t total = 0;
+      for (const auto &entry : entries) total += textureLoader().gpuBytes(entry.second.id);
+      return total;
+    }
+
+private:
+    struct Entry {
+      unsigned int id;
+      unsigned int refs;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<unsigned int, std::string> keys;
+
+    static std::string canonical(const std::string &file) {
+      std::error_code error;
+      std::filesystem::path path = std::filesystem::weakly_canonical(file, error);
+      return error ? file : path.string();
+    }
+};
+
+inline TextureCache &textureCache()
+{
+  static TextureCache cache;
+  return cache;
+}
+
+#endif
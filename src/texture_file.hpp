@@ -0,0 +1,158 @@
+#ifndef TEXTURE_FILE_HPP
+#define TEXTURE_FILE_HPP
+
+#include "glad/glad.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+// Cache of a texture's final mip chain in the format it is uploaded in, written next to the
+// source image. Warm loads map the file and upload the levels straight from the mapping,
+// without decoding or compressing anything.
+//
+// file layout (host byte order, every section starts on a 16 byte boundary):
+//   TextureFileHeader
+//   for each level, largest first: TextureFileLevel, then its data
+
+struct TextureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format; // GL internal format
+    uint64_t key;
+    uint32_t numLevels;
+    uint32_t reserved[3];
+};
+
+struct TextureFileLevel {
+    uint32_t width;
+    uint32_t height;
+    uint64_t size;
+};
+
+// one mip level, data points into a TextureFile mapping or into memory the owner keeps alive
+struct TextureLevel {
+    int width;
+    int height;
+    const unsigned char *data;
+    size_t size;
+};
+
+class TextureFile {
+public:
+    static constexpr uint32_t VERSION = 2; // 2: BC4 and BC5 for grey and grey alpha images
+
+    GLenum format = 0;
+    // views into the mapped file, valid as long as this TextureFile lives
+    std::vector<TextureLevel> levels;
+
+    static std::string cachePath(const std::string &file) {
+      return file + ".texcache";
+    }
+
+    // hash of the source file contents, the settings it was processed with and the file format,
+    // returns 0 if the source file cannot be read
+    static uint64_t makeKey(const std::string &file, uint32_t settings) {
+      MappedFile source;
+      if (!source.open(file)) return 0;
+      uint64_t hash = fnv1a(14695981039346656037ull, source.data, source.size);
+      const uint32_t extra[2] = { settings, VERSION };
+      hash = fnv1a(hash, (const unsigned char *)extra, sizeof(extra));
+      return hash ? hash : 1;
+    }
+
+    // maps cacheFile and validates it against key, fills format and levels on success
+    bool open(const std::string &cacheFile, uint64_t key) {
+      levels.clear();
+      if (key == 0 || !file.open(cacheFile)) return false;
+      size_t offset = 0;
+      const TextureFileHeader *header = (const TextureFileHeader *)read(offset, sizeof(TextureFileHeader));
+      if (!header
+          || std::memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0
+          || header->version != VERSION
+          || header->key != key
+          || header->numLevels == 0) {
+        return fail();
+      }
+      format = header->format;
+      for (uint32_t i = 0; i < header->numLevels; i++) {
+        const TextureFileLevel *level = (const TextureFileLevel *)read(offset, sizeof(TextureFileLevel));
+        if (!level) return fail();
+        const unsigned char *data = (const unsigned char *)read(offset, level->size);
+        if (!data) return fail();
+        levels.push_back({ (int)level->width, (int)level->height, data, (size_t)level->size });
+      }
+      return true;
+    }
+
+    // writes through a temporary file so that a crash never leaves a truncated cache behind
+    static bool write(const std::string &cacheFile, uint64_t key, GLenum format, const std::vector<TextureLevel> &levels) {
+      const std::string tmpFile = cacheFile + ".tmp";
+      {
+        std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        TextureFileHeader header = {};
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.format = format;
+        header.key = key;
+        header.numLevels = levels.size();
+        put(out, &header, sizeof(header));
+        for (const TextureLevel &level : levels) {
+          const TextureFileLevel raw = { (uint32_t)level.width, (uint32_t)level.height, level.size };
+          put(out, &raw, sizeof(raw));
+          put(out, level.data, level.size);
+        }
+        if (!out) {
+          std::remove(tmpFile.c_str());
+          return false;
+        }
+      }
+      if (std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+        std::remove(tmpFile.c_str());
+        return false;
+      }
+      return true;
+    }
+
+private:
+    static constexpr char MAGIC[8] = { 'L', 'O', 'G', 'L', 'T', 'E', 'X', '1' };
+
+    MappedFile file;
+
+    static uint64_t fnv1a(uint64_t hash, const unsigned char *data, size_t size) {
+      for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+      }
+      return hash;
+    }
+
+    static size_t pad(size_t size) { return (size + 15) & ~(size_t)15; }
+
+    const void *read(size_t &offset, size_t size) {
+      if (offset > file.size || file.size - offset < size) return nullptr;
+      const void *ptr = file.data + offset;
+      offset = pad(offset + size);
+      return ptr;
+    }
+
+    static void put(std::ofstream &out, const void *data, size_t size) {
+      static const char zeros[16] = {};
+      out.write((const char *)data, size);
+      out.write(zeros, pad(size) - size);
+    }
+
+    bool fail() {
+      levels.clear();
+      file.close();
+      return false;
+    }
+};
+
+#endif
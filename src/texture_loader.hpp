@@ -0,0 +1,484 @@
+#ifndef TEXTURE_LOADER_HPP
+#define TEXTURE_LOADER_HPP
+
+#include "glad/glad.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "stb_image.h"
+
+#include "bc_encode.hpp"
+#include "gl_state.hpp"
+#include "load_trace.hpp"
+#include "mipmap.hpp"
+#include "texture_file.hpp"
+#include "thread_pool.hpp"
+
+// where loadArrays() put a file: layer of the GL_TEXTURE_2D_ARRAY id
+struct TextureLayer {
+    unsigned int id;
+    int layer;
+};
+
+// Loads 2D textures without stalling the GL thread: load() hands out a texture id that
+// samples a 1x1 placeholder right away and queues the decode on defaultThreadPool(),
+// update() later re-specifies the same id with the decoded image through a pixel unpack
+// buffer. Because the id never changes, meshes keep their Texture values as they are.
+//
+// The mip chain is built on the CPU (cf. mipmap.hpp) instead of by glGenerateMipmap.
+// Cached loads keep the finished chain in a TextureFile next to the source, so that later
+// runs only map that file and upload it level by level; compressed loads turn every level
+// into BC1 (opaque), BC3 (with alpha), BC4 (grey) or BC5 (grey alpha) blocks and are always
+// cached.
+class TextureLoader {
+public:
+    enum Flags : unsigned int {
+      COMPRESS = 1 << 0,        // BC1/BC3/BC4/BC5 where the context supports S3TC, implies CACHE
+      CACHE = 1 << 1,           // read and write <image>.texcache
+      SRGB = 1 << 2,            // colour data, mip levels are averaged in linear light
+      FLIP_VERTICALLY = 1 << 3, // first image row at the bottom (stbi's flip, per load)
+    };
+
+    TextureLoader() = default;
+    TextureLoader(const TextureLoader &) = delete;
+    TextureLoader &operator=(const TextureLoader &) = delete;
+    ~TextureLoader()
+    {
+      // GL is usually gone by now, only free what the workers produced
+      for (Job &job : jobs) {
+        Image image = job.result.get();
+        release(image);
+      }
+    }
+
+    unsigned int load(const std::string &file, unsigned int flags = 0)
+    {
+      unsigned int id = createPlaceholder();
+      flags = supportedFlags(flags);
+      Job job;
+      job.id = id;
+      job.file = file;
+      job.result = defaultThreadPool().submit([this, file, flags]() { return decode(file, flags); });
+      jobs.push_back(std::move(job));
+      return id;
+    }
+
+    // decodes and uploads on the calling thread, which defaultThreadPool() helps with mip
+    // filtering and block encoding
+    unsigned int loadNow(const std::string &file, unsigned int flags = 0)
+    {
+      unsigned int id;
+      glGenTextures(1, &id);
+      Image image = decode(file, supportedFlags(flags), &defaultThreadPool());
+      upload(id, file, image, false);
+      return id;
+    }
+
+    // decodes on the calling thread like loadNow() and specifies every level of the texture
+    // bound to GL_TEXTURE_2D, for code that creates and configures its own texture objects;
+    // false if file cannot be read, the texture is left alone then
+    bool loadBound(const std::string &file, unsigned int flags = 0)
+    {
+      Image image = decode(file, supportedFlags(flags), &defaultThreadPool());
+      if (!image.format) return false;
+      specify(image, false);
+      release(image);
+      return true;
+    }
+
+    // decodes files (one flags entry each) on defaultThreadPool() and packs the ones that
+    // agree in size, format and number of levels into the layers of GL_TEXTURE_2D_ARRAY
+    // textures, at most MAX_ARRAY_LAYERS per array; returns where every file ended up, in
+    // order, gpuBytes() and forget() take the array ids
+    std::vector<TextureLayer> loadArrays(const std::vector<std::string> &files, const std::vector<unsigned int> &flags)
+    {
+      std::vector<std::future<Image>> results;
+      for (size_t i = 0; i < files.size(); i++) {
+        const unsigned int fileFlags = supportedFlags(flags[i]);
+        results.push_back(defaultThreadPool().submit([this, file = files[i], fileFlags]() { return decode(file, fileFlags); }));
+      }
+      std::vector<Image> images;
+      for (std::future<Image> &result : results) images.push_back(result.get());
+      for (size_t i = 0; i < files.size(); i++) {
+        if (!images[i].format) {
+          std::cout << "failed to load texture " << files[i] << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      std::vector<TextureLayer> layers(files.size());
+      std::vector<bool> packed(files.size(), false);
+      for (size_t i = 0; i < files.size(); i++) {
+        if (packed[i]) continue;
+        std::vector<size_t> group;
+        for (size_t j = i; j < files.size() && group.size() < MAX_ARRAY_LAYERS; j++) {
+          if (!packed[j] && sameShape(images[i], images[j])) {
+            group.push_back(j);
+            packed[j] = true;
+          }
+        }
+        const unsigned int id = uploadArray(images, group, files[i]);
+        for (size_t layer = 0; layer < group.size(); layer++) layers[group[layer]] = { id, (int)layer };
+      }
+      for (Image &image : images) release(image);
+      return layers;
+    }
+
+    // uploads finished decodes until budgetMs is spent (always at least one),
+    // returns the number of textures that are still pending
+    size_t update(float budgetMs = 2.0f)
+    {
+      const auto start = std::chrono::steady_clock::now();
+      size_t uploaded = 0;
+      for (size_t i = 0; i < jobs.size();) {
+        const float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (uploaded > 0 && elapsedMs > budgetMs) break;
+        if (jobs[i].result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+          i++;
+          continue;
+        }
+        Image image = jobs[i].result.get();
+        if (jobs[i].cancelled) {
+          release(image);
+        } else {
+          upload(jobs[i].id, jobs[i].file, image, true);
+          uploaded++;
+        }
+        jobs.erase(jobs.begin() + i);
+      }
+      return jobs.size();
+    }
+
+    // blocks until every queued texture is uploaded
+    void finish()
+    {
+      while (!jobs.empty()) {
+        jobs.front().result.wait();
+        update(1e9f);
+      }
+    }
+
+    size_t pending() const { return jobs.size(); }
+
+    // time spent decoding (summed over the workers) and uploading so far
+    double decodeMs() const { return decodeNanos.load() * 1e-6; }
+    double uploadMs() const { return uploadNanos * 1e-6; }
+
+    // bytes of the image (including mip levels) currently specified for id
+    size_t gpuBytes(unsigned int id) const
+    {
+      auto it = bytes.find(id);
+      return it == bytes.end() ? 0 : it->second;
+    }
+
+    // whether the context can sample S3TC textures, compressed loads fall back to plain
+    // uploads without it; asks GL the first time, so call it on the GL thread
+    bool compressionSupported()
+    {
+      if (s3tc < 0) s3tc = hasGlExtension("GL_EXT_texture_compression_s3tc");
+      return s3tc;
+    }
+
+    // writes the cache of file ahead of time (no GL needed, CACHE is implied), pool spreads
+    // mip filtering and block encoding over its workers; false if the image or the cache
+    // cannot be written
+    static bool bake(const std::string &file, unsigned int flags, ThreadPool *pool = nullptr)
+    {
+      Image image = decodeImage(file, flags & ~CACHE, pool);
+      if (!image.format) return false;
+      const bool written = TextureFile::write(TextureFile::cachePath(file), TextureFile::makeKey(file, settingsOf(flags)),
+          image.format, image.levels);
+      release(image);
+      return written;
+    }
+
+    // stops tracking id before it is deleted, a pending decode for it is dropped
+    void forget(unsigned int id)
+    {
+      bytes.erase(id);
+      for (Job &job : jobs)
+        if (job.id == id) job.cancelled = true;
+    }
+
+    // the least GL_MAX_ARRAY_TEXTURE_LAYERS that GL 3.3 guarantees
+    static constexpr size_t MAX_ARRAY_LAYERS = 256;
+
+private:
+    struct Image {
+      GLenum format = 0; // sized or compressed internal format, 0 if the file could not be read
+      std::vector<TextureLevel> levels;
+      // what the levels point into: stbi's pixels (level 0 of uncompressed images), generated
+      // levels or blocks, or a cache mapping
+      unsigned char *pixels = nullptr;
+      std::vector<unsigned char> storage;
+      std::unique_ptr<TextureFile> file;
+    };
+
+    struct Job {
+      unsigned int id;
+      std::string file;
+      std::future<Image> result;
+      bool cancelled = false;
+    };
+
+    std::vector<Job> jobs;
+    std::unordered_map<unsigned int, size_t> bytes;
+    unsigned int pbo = 0;
+    int s3tc = -1; // unknown until compressionSupported() asks
+    std::atomic<uint64_t> decodeNanos{0};
+    uint64_t uploadNanos = 0;
+
+    unsigned int supportedFlags(unsigned int flags)
+    {
+      if ((flags & COMPRESS) && !compressionSupported()) flags &= ~COMPRESS;
+      return flags & COMPRESS ? flags | CACHE : flags;
+    }
+
+    // the flags that change the cached levels, part of the cache key
+    static uint32_t settingsOf(unsigned int flags)
+    {
+      return flags & (COMPRESS | SRGB | FLIP_VERTICALLY);
+    }
+
+    static uint64_t nanosecondsSince(std::chrono::steady_clock::time_point start)
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static GLenum sizedFormatOf(int channels)
+    {
+      switch (channels) {
+        case 1: return GL_R8;
+        case 2: return GL_RG8;
+        case 3: return GL_RGB8;
+        default: return GL_RGBA8;
+      }
+    }
+
+    // pixel transfer format of a sized format, 0 for compressed ones
+    static GLenum pixelFormatOf(GLenum format)
+    {
+      switch (format) {
+        case GL_R8: return GL_RED;
+        case GL_RG8: return GL_RG;
+        case GL_RGB8: return GL_RGB;
+        case GL_RGBA8: return GL_RGBA;
+        default: return 0;
+      }
+    }
+
+    // runs on the workers without a pool, or on the calling thread with one
+    Image decode(const std::string &file, unsigned int flags, ThreadPool *pool = nullptr)
+    {
+      TraceSpan span("texture", "decode", file);
+      const auto start = std::chrono::steady_clock::now();
+      Image image = decodeImage(file, flags, pool);
+      decodeNanos += nanosecondsSince(start);
+      return image;
+    }
+
+    // a pool only makes sense where the caller is not one of its tasks
+    static Image decodeImage(const std::string &file, unsigned int flags, ThreadPool *pool)
+    {
+      Image image;
+      const bool compress = flags & COMPRESS;
+      uint64_t key = 0;
+      if (flags & CACHE) {
+        key = TextureFile::makeKey(file, settingsOf(flags));
+        image.file = std::make_unique<TextureFile>();
+        if (image.file->open(TextureFile::cachePath(file), key)) {
+          image.format = image.file->format;
+          image.levels = image.file->levels;
+          return image;
+        }
+        image.file.reset();
+      }
+
+      int width, height, channels;
+      stbi_set_flip_vertically_on_load_thread(flags & FLIP_VERTICALLY);
+      image.pixels = stbi_load(file.c_str(), &width, &height, &channels, 0);
+      if (!image.pixels) return image;
+      MipChain chain = generateMipChain(image.pixels, width, height, channels, flags & SRGB, pool);
+      if (compress) {
+        const BlockFormat format = blockFormatFor(image.pixels, width, height, channels);
+        std::vector<std::vector<uint8_t>> blocks;
+        blocks.push_back(compressImage(image.pixels, width, height, channels, format, pool));
+        for (const TextureLevel &level : chain.levels)
+          blocks.push_back(compressImage(level.data, level.width, level.height, channels, format, pool));
+        size_t total = 0;
+        for (const std::vector<uint8_t> &data : blocks) total += data.size();
+        image.storage.resize(total);
+        size_t offset = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+          std::memcpy(image.storage.data() + offset, blocks[i].data(), blocks[i].size());
+          const int levelWidth = i == 0 ? width : chain.levels[i - 1].width;
+          const int levelHeight = i == 0 ? height : chain.levels[i - 1].height;
+          image.levels.push_back({ levelWidth, levelHeight, image.storage.data() + offset, blocks[i].size() });
+          offset += blocks[i].size();
+        }
+        image.format = glFormatOf(format);
+        stbi_image_free(image.pixels);
+        image.pixels = nullptr;
+      } else {
+        image.format = sizedFormatOf(channels);
+        image.levels.push_back({ width, height, image.pixels, (size_t)width * height * channels });
+        image.levels.insert(image.levels.end(), chain.levels.begin(), chain.levels.end());
+        // the buffer moves along, the levels keep pointing into it
+        image.storage = std::move(chain.data);
+      }
+      if (key != 0 && !TextureFile::write(TextureFile::cachePath(file), key, image.format, image.levels))
+        std::cout << "failed to write texture cache " << TextureFile::cachePath(file) << std::endl;
+      return image;
+    }
+
+    static void release(Image &image)
+    {
+      stbi_image_free(image.pixels);
+      image.pixels = nullptr;
+      image.levels.clear();
+      image.storage = std::vector<unsigned char>();
+      image.file.reset();
+    }
+
+    static void setParameters(GLenum target = GL_TEXTURE_2D)
+    {
+      glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+      glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+      glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+      glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    // whether b fits into the same array as a
+    static bool sameShape(const Image &a, const Image &b)
+    {
+      return a.format == b.format && a.levels.size() == b.levels.size()
+          && a.levels[0].width == b.levels[0].width && a.levels[0].height == b.levels[0].height;
+    }
+
+    // one array holding images[group[i]] as layer i, returns its id
+    unsigned int uploadArray(const std::vector<Image> &images, const std::vector<size_t> &group, const std::string &file)
+    {
+      TraceSpan span("texture", "upload array", file);
+      const auto start = std::chrono::steady_clock::now();
+      const Image &first = images[group[0]];
+      const GLenum pixelFormat = pixelFormatOf(first.format);
+      const GLsizei numLayers = group.size();
+      unsigned int id;
+      glGenTextures(1, &id);
+      glState().bindTexture(GL_TEXTURE_2D_ARRAY, id);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      size_t total = 0;
+      for (size_t level = 0; level < first.levels.size(); level++) {
+        const TextureLevel &shape = first.levels[level];
+        // storage for all layers first, then one layer at a time
+        if (pixelFormat == 0)
+          glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.format, shape.width, shape.height, numLayers, 0,
+              shape.size * numLayers, nullptr);
+        else
+          glTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.format, shape.width, shape.height, numLayers, 0, pixelFormat,
+              GL_UNSIGNED_BYTE, nullptr);
+        for (GLsizei layer = 0; layer < numLayers; layer++) {
+          const TextureLevel &data = images[group[layer]].levels[level];
+          if (pixelFormat == 0)
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, data.width, data.height, 1, first.format,
+                data.size, data.data);
+          else
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, data.width, data.height, 1, pixelFormat,
+                GL_UNSIGNED_BYTE, data.data);
+        }
+        total += shape.size * numLayers;
+      }
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.levels.size() - 1);
+      setParameters(GL_TEXTURE_2D_ARRAY);
+      bytes[id] = total;
+      uploadNanos += nanosecondsSince(start);
+      return id;
+    }
+
+    unsigned int createPlaceholder()
+    {
+      static const unsigned char grey[4] = { 128, 128, 128, 255 };
+      unsigned int id;
+      glGenTextures(1, &id);
+      glState().bindTexture(GL_TEXTURE_2D, id);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+      setParameters();
+      bytes[id] = sizeof(grey);
+      return id;
+    }
+
+    // specifies all levels of the bound texture, returns their size in bytes
+    size_t specify(const Image &image, bool viaPbo)
+    {
+      const bool compressed = pixelFormatOf(image.format) == 0;
+      size_t total = 0;
+      for (const TextureLevel &level : image.levels) total += level.size;
+
+      if (viaPbo) {
+        // orphan and refill the staging buffer, the driver copies from it asynchronously
+        if (!pbo) glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, total, nullptr, GL_STREAM_DRAW);
+        unsigned char *staging = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        for (const TextureLevel &level : image.levels) {
+          std::memcpy(staging, level.data, level.size);
+          staging += level.size;
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      }
+
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      size_t offset = 0;
+      for (size_t i = 0; i < image.levels.size(); i++) {
+        const TextureLevel &level = image.levels[i];
+        // offsets into the bound unpack buffer when staged
+        const void *data = viaPbo ? (const void *)offset : level.data;
+        if (compressed)
+          glCompressedTexImage2D(GL_TEXTURE_2D, i, image.format, level.width, level.height, 0, level.size, data);
+        else
+          glTexImage2D(GL_TEXTURE_2D, i, image.format, level.width, level.height, 0, pixelFormatOf(image.format),
+              GL_UNSIGNED_BYTE, data);
+        offset += level.size;
+      }
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels.size() - 1);
+      if (viaPbo) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return total;
+    }
+
+    void upload(unsigned int id, const std::string &file, Image &image, bool viaPbo)
+    {
+      if (!image.format) {
+        std::cout << "failed to load texture " << file << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      TraceSpan span("texture", "upload", file);
+      const auto start = std::chrono::steady_clock::now();
+      glState().bindTexture(GL_TEXTURE_2D, id);
+      bytes[id] = specify(image, viaPbo);
+      setParameters();
+      release(image);
+      uploadNanos += nanosecondsSince(start);
+    }
+};
+
+// process wide loader, update() it once per frame on the GL thread
+inline TextureLoader &textureLoader()
+{
+  static TextureLoader loader;
+  return loader;
+}
+
+#endif
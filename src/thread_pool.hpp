@@ -0,0 +1,83 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed size pool of worker threads that run tasks in submission order
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int numThreads = std::thread::hardware_concurrency())
+    {
+      numThreads = std::max(1u, numThreads);
+      for (unsigned int i = 0; i < numThreads; i++)
+        workers.emplace_back([this]() { run(); });
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wakeup.notify_all();
+      for (std::thread &worker : workers) worker.join();
+    }
+
+    unsigned int size() const { return workers.size(); }
+
+    // queues task and returns a future for its result,
+    // tasks must not wait on other tasks of the same pool
+    template <typename F>
+    auto submit(F &&task) -> std::future<decltype(task())>
+    {
+      using R = decltype(task());
+      auto packaged = std::make_shared<std::packaged_task<R()>>(std::forward<F>(task));
+      std::future<R> result = packaged->get_future();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.emplace_back([packaged]() { (*packaged)(); });
+      }
+      wakeup.notify_one();
+      return result;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+
+    void run()
+    {
+      for (;;) {
+        std::function<void()> task;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          wakeup.wait(lock, [this]() { return stopping || !tasks.empty(); });
+          if (stopping && tasks.empty()) return;
+          task = std::move(tasks.front());
+          tasks.pop_front();
+        }
+        task();
+      }
+    }
+};
+
+// process wide pool shared by the loaders, sized to the number of cores
+inline ThreadPool &defaultThreadPool()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+#endif